@@ -33,6 +33,7 @@
 #include "constrain.h"
 #include "router.h"
 #include "node.h"
+#include "trace.h"
 
 static mir_constr_def *cstrdef_create(struct userdata *, const char *,
                                       mir_constrain_func_t, const char *);
@@ -206,8 +207,8 @@ void mir_constrain_apply(struct userdata *u, mir_node *node, uint32_t stamp)
                 rte->blocked = blocked;
                 rte->stamp   = stamp;
 
-                pa_log_debug("   %sblocking '%s' in table '%s'",
-                             blocked ? "":"un", n->amname, rtg->name);
+                mir_trace(u, mir_trace_constrain, mir_trace_constrain_block,
+                          stamp, n->index, n->type, blocked, node->index);
             }
         }
     }
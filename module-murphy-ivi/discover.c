@@ -34,6 +34,7 @@
 #include <pulsecore/sink-input.h>
 #include <pulsecore/source-output.h>
 #include <pulsecore/strbuf.h>
+#include <pulsecore/core-rtclock.h>
 
 #include "discover.h"
 #include "node.h"
@@ -53,21 +54,19 @@
 
 #define ACTIVE_PORT       NULL
 
-typedef struct {
-    struct userdata *u;
-    uint32_t index;
-} card_check_t;
+#define HOTPLUG_MAX_WINDOWS  10  /* a storm is held at most this long */
 
-typedef struct {
-    struct userdata *u;
-    pa_muxnode *mux;
-    pa_loopnode *loop;
-} source_cleanup_t;
+#define WORK_KEY(k, o)  (((uint64_t)(k) << 32) | (uint64_t)(o))
 
 typedef struct {
-    struct userdata *u;
-    uint32_t index;
-} stream_uncork_t;
+    mir_dlist    link;     /**< discover->work.queue[kind] */
+    uint64_t     key;      /**< kind and object, the key in the pending hash*/
+    enum pa_discover_work_kind kind;
+    uint32_t     object;   /**< card or node index; 0 for routing */
+    bool         pending;  /**< can be merged into until dispatched */
+    pa_muxnode  *mux;      /**< for source cleanups */
+    pa_loopnode *loop;     /**< for source cleanups */
+} deferred_work_t;
 
 static const char combine_pattern[]   = "Simultaneous output on ";
 static const char loopback_outpatrn[] = "Loopback from ";
@@ -86,16 +85,20 @@ static mir_node *create_node(struct userdata *, mir_node *, bool *);
 static void destroy_node(struct userdata *, mir_node *);
 static bool update_node_availability(struct userdata *, mir_node *,
                                           bool);
-static bool update_node_availability_by_device(struct userdata *,
-                                                    mir_direction,
-                                                    void *, pa_device_port *,
-                                                    bool);
+static pa_discover_card_nodes *get_card_nodes(struct userdata *, uint32_t,
+                                              bool);
 
 static void parse_profile_name(pa_card_profile *,
                                char **, char **, char *, int);
 
-static const char *node_key(struct userdata *, mir_direction,
-                      void *, pa_device_port *, char *, size_t);
+static bool node_key(struct userdata *, mir_direction,
+                     void *, pa_device_port *, uint64_t *);
+static uint64_t make_node_key(struct userdata *, const char *, const char *,
+                              const char *);
+static uint32_t name_id(struct userdata *, const char *, bool);
+static mir_node *find_node_by_ikey(struct userdata *, uint64_t);
+static unsigned node_key_hash(const void *);
+static int node_key_compare(const void *, const void *);
 
 static pa_sink *make_output_prerouting(struct userdata *, mir_node *,
                                        pa_channel_map *, const char *,
@@ -109,16 +112,39 @@ static const char *get_stream_amname(mir_node_type, const char *, pa_proplist *)
 static void set_bluetooth_profile(struct userdata *, pa_card *, pa_direction_t);
 
 
+static int node_object_type(mir_node *);
+static mir_node *find_node_by_object(struct userdata *, int, uint32_t, void *);
+static void node_table_set(pa_discover_node_table *, uint32_t, void *,
+                           mir_node *);
+static void node_table_clear(pa_discover_node_table *, uint32_t, void *);
+static bool node_table_grow(pa_discover_node_table *);
+
 static void schedule_deferred_routing(struct userdata *);
 static void schedule_card_check(struct userdata *, pa_card *);
 static void schedule_source_cleanup(struct userdata *, mir_node *);
 #if 0
 static void schedule_stream_uncorking(struct userdata *, pa_sink *);
 #endif
-
-struct pa_discover *pa_discover_init(struct userdata *u)
+static deferred_work_t *schedule_work(struct userdata *,
+                                      enum pa_discover_work_kind, uint32_t);
+static deferred_work_t *queue_work(struct userdata *,
+                                   enum pa_discover_work_kind, uint32_t, bool);
+static void work_event_cb(pa_mainloop_api *, pa_defer_event *, void *);
+static void check_card(struct userdata *, uint32_t);
+static void cleanup_source(struct userdata *, deferred_work_t *);
+
+static void hotplug_begin(struct userdata *);
+static void hotplug_settled(struct userdata *);
+static void hotplug_timer_cb(pa_mainloop_api *, pa_time_event *,
+                             const struct timeval *, void *);
+static void hotplug_defer_cb(pa_mainloop_api *, pa_defer_event *, void *);
+
+struct pa_discover *pa_discover_init(struct userdata *u, const char *settle)
 {
     pa_discover *discover = pa_xnew0(pa_discover, 1);
+    pa_mainloop_api *mainloop = u->core->mainloop;
+    int32_t window;
+    int i;
 
     discover->chmin = 1;
     discover->chmax = 2;
@@ -128,6 +154,29 @@ struct pa_discover *pa_discover_init(struct userdata *u)
                                             pa_idxset_string_compare_func);
     discover->nodes.byptr  = pa_hashmap_new(pa_idxset_trivial_hash_func,
                                             pa_idxset_trivial_compare_func);
+    discover->nodes.bykey  = pa_hashmap_new(node_key_hash, node_key_compare);
+    discover->nodes.bycard = pa_hashmap_new_full(pa_idxset_trivial_hash_func,
+                                                 pa_idxset_trivial_compare_func,
+                                                 NULL, pa_xfree);
+
+    discover->names.ids = pa_hashmap_new_full(pa_idxset_string_hash_func,
+                                              pa_idxset_string_compare_func,
+                                              pa_xfree, NULL);
+
+    if (!settle || pa_atoi(settle, &window) < 0 || window < 0)
+        window = 0;
+
+    discover->hotplug.window = (pa_usec_t)window * PA_USEC_PER_MSEC;
+    discover->hotplug.defer = mainloop->defer_new(mainloop, hotplug_defer_cb,
+                                                  u);
+    mainloop->defer_enable(discover->hotplug.defer, 0);
+
+    discover->work.pending = pa_hashmap_new(node_key_hash, node_key_compare);
+    for (i = 0;  i < pa_discover_work_max;  i++)
+        MIR_DLIST_INIT(discover->work.queue[i]);
+    discover->work.defer = mainloop->defer_new(mainloop, work_event_cb, u);
+    mainloop->defer_enable(discover->work.defer, 0);
+
     return discover;
 }
 
@@ -136,13 +185,42 @@ void pa_discover_done(struct userdata *u)
     pa_discover *discover;
     void *state;
     mir_node *node;
+    deferred_work_t *work, *n;
+    int i;
 
     if (u && (discover = u->discover)) {
+        if (discover->hotplug.timer)
+            u->core->mainloop->time_free(discover->hotplug.timer);
+        if (discover->hotplug.defer)
+            u->core->mainloop->defer_free(discover->hotplug.defer);
+        if (discover->work.defer)
+            u->core->mainloop->defer_free(discover->work.defer);
+
+        for (i = 0;  i < pa_discover_work_max;  i++) {
+            MIR_DLIST_FOR_EACH_SAFE(deferred_work_t, link, work,n,
+                                    &discover->work.queue[i])
+            {
+                MIR_DLIST_UNLINK(deferred_work_t, link, work);
+
+                /* the combine sinks and loopbacks would leak otherwise */
+                if (i == pa_discover_work_source_cleanup)
+                    cleanup_source(u, work);
+
+                pa_xfree(work);
+            }
+        }
+        pa_hashmap_free(discover->work.pending);
+
         PA_HASHMAP_FOREACH(node, discover->nodes.byname, state) {
             mir_node_destroy(u, node);
         }
         pa_hashmap_free(discover->nodes.byname);
         pa_hashmap_free(discover->nodes.byptr);
+        pa_hashmap_free(discover->nodes.bykey);
+        pa_hashmap_free(discover->nodes.bycard);
+        pa_hashmap_free(discover->names.ids);
+        for (i = 0;  i < pa_discover_object_max;  i++)
+            pa_xfree(discover->nodes.bytype[i].slots);
         pa_xfree(discover);
         u->discover = NULL;
     }
@@ -186,10 +264,12 @@ void pa_discover_add_card(struct userdata *u, pa_card *card)
     }
 
     if (pa_streq(bus, "pci") || pa_streq(bus, "usb") || pa_streq(bus, "platform")) {
+        hotplug_begin(u);
         handle_alsa_card(u, card);
         return;
     }
     else if (pa_streq(bus, "bluetooth")) {
+        hotplug_begin(u);
         handle_bluetooth_card(u, card);
         return;
     }
@@ -202,8 +282,8 @@ void pa_discover_remove_card(struct userdata *u, pa_card *card)
 {
     const char  *bus;
     pa_discover *discover;
-    mir_node    *node;
-    void        *state;
+    pa_discover_card_nodes *cn;
+    mir_node    *node, *n;
 
     pa_assert(u);
     pa_assert(card);
@@ -212,15 +292,20 @@ void pa_discover_remove_card(struct userdata *u, pa_card *card)
     if (!(bus = pa_utils_get_card_bus(card)))
         bus = "<unknown>";
 
-    PA_HASHMAP_FOREACH(node, discover->nodes.byname, state) {
-        if (node->implement == mir_device &&
-            node->pacard.index == card->index)
-        {
+    if ((cn = get_card_nodes(u, card->index, false))) {
+        MIR_DLIST_FOR_EACH_SAFE(mir_node,cardchain, node,n, &cn->nodes) {
             if (pa_streq(bus, "pci") || pa_streq(bus, "usb") || pa_streq(bus, "platform"))
                 mir_constrain_destroy(u, node->paname);
 
             destroy_node(u, node);
         }
+
+        /* whatever destroy_node() refused to destroy must not point here */
+        MIR_DLIST_FOR_EACH_SAFE(mir_node,cardchain, node,n, &cn->nodes)
+            MIR_DLIST_UNLINK(mir_node,cardchain, node);
+
+        pa_hashmap_remove(discover->nodes.bycard, PA_UINT32_TO_PTR(card->index));
+        pa_xfree(cn);
     }
 
     if (pa_streq(bus, "bluetooth"))
@@ -240,16 +325,19 @@ void pa_discover_profile_changed(struct userdata *u, pa_card *card)
     bool        bluetooth;
     bool	platform;
     uint32_t         stamp;
-    mir_node        *node;
-    void            *state;
+    pa_discover_card_nodes *cn;
+    mir_node        *node, *n;
     uint32_t         index;
     bool        need_routing;
+    pa_usec_t        start;
 
     pa_assert(u);
     pa_assert(card);
     pa_assert_se((core = u->core));
     pa_assert_se((discover = u->discover));
 
+    start = pa_rtclock_now();
+
     if ((bus = pa_utils_get_card_bus(card)) == NULL) {
         pa_log_debug("ignoring profile change on card '%s' due to lack of '%s'"
                      "property", pa_utils_get_card_name(card),
@@ -295,23 +383,24 @@ void pa_discover_profile_changed(struct userdata *u, pa_card *card)
             /* switched off but not unloaded yet */
             need_routing = false;
 
-            PA_HASHMAP_FOREACH(node, discover->nodes.byname, state) {
-                if (node->implement == mir_device &&
-                    node->pacard.index == card->index)
-                {
+            if ((cn = get_card_nodes(u, card->index, false))) {
+                MIR_DLIST_FOR_EACH(mir_node,cardchain, node, &cn->nodes) {
                     if (node->type != mir_bluetooth_a2dp &&
                         node->type != mir_bluetooth_sco)
                     {
                         if (node->available) {
                             node->available = false;
+                            mir_router_mark_node_dirty(u, node);
                             need_routing = true;
                         }
                     }
                 }
             }
 
-            if (need_routing)
+            if (need_routing) {
+                mir_router_note_device_event(u, start);
                 schedule_deferred_routing(u);
+            }
         }
     }
     else {
@@ -322,12 +411,10 @@ void pa_discover_profile_changed(struct userdata *u, pa_card *card)
 
         handle_alsa_card(u, card);
 
-        PA_HASHMAP_FOREACH(node, discover->nodes.byname, state) {
-            if (node->implement == mir_device &&
-                node->pacard.index == card->index &&
-                node->stamp < stamp)
-            {
-                destroy_node(u, node);
+        if ((cn = get_card_nodes(u, card->index, false))) {
+            MIR_DLIST_FOR_EACH_SAFE(mir_node,cardchain, node,n, &cn->nodes) {
+                if (node->stamp < stamp)
+                    destroy_node(u, node);
             }
         }
     }
@@ -338,21 +425,23 @@ void pa_discover_port_available_changed(struct userdata *u,
                                         pa_device_port  *port)
 {
     pa_core       *core;
-    pa_sink       *sink;
-    pa_source     *source;
+    pa_discover_card_nodes *cn;
     mir_node      *node;
-    uint32_t       idx;
+    mir_direction  nodedir;
     bool      available;
     const char    *state;
     bool      btport;
     bool      route;
     pa_direction_t direction;
     void          *iter;
+    pa_usec_t      start;
 
     pa_assert(u);
     pa_assert(port);
     pa_assert_se((core = u->core));
 
+    start = pa_rtclock_now();
+
     switch (port->available) {
     case PA_AVAILABLE_NO:    state = "not available";  break;
     case PA_AVAILABLE_YES:   state = "available";      break;
@@ -383,37 +472,26 @@ void pa_discover_port_available_changed(struct userdata *u,
         default:                 /* do nothing */      return;
         }
 
-        if (port->direction == PA_DIRECTION_OUTPUT) {
-            PA_IDXSET_FOREACH(sink, core->sinks, idx) {
-                if (sink->ports) {
-                    if (port == pa_hashmap_get(sink->ports, port->name)) {
-                        pa_log_debug("   sink '%s'", sink->name);
-                        route |= update_node_availability_by_device(
-                                                     u, mir_output,
-                                                     sink, port,
-                                                     available);
-                    }
-                }
-            }
-        }
+        nodedir = (port->direction == PA_DIRECTION_OUTPUT) ?
+                  mir_output : mir_input;
 
-        if (port->direction == PA_DIRECTION_INPUT) {
-            PA_IDXSET_FOREACH(source, core->sources, idx) {
-                if (source->ports) {
-                    if (port == pa_hashmap_get(source->ports, port->name)) {
-                        pa_log_debug("   source '%s'", source->name);
-                        route |= update_node_availability_by_device(
-                                                      u, mir_input,
-                                                      source, port,
-                                                      available);
-                    }
+        /* only the nodes of the port's own card are looked at */
+        if (port->card && (cn = get_card_nodes(u, port->card->index, false))) {
+            MIR_DLIST_FOR_EACH(mir_node,cardchain, node, &cn->nodes) {
+                if (node->direction == nodedir && node->paport &&
+                    pa_streq(node->paport, port->name))
+                {
+                    pa_log_debug("   node '%s'", node->paname);
+                    route |= update_node_availability(u, node, available);
                 }
             }
         }
     }
 
-    if (route)
-        mir_router_make_routing(u);
+    if (route) {
+        mir_router_note_device_event(u, start);
+        mir_router_make_incremental_routing(u);
+    }
 }
 
 void pa_discover_add_sink(struct userdata *u, pa_sink *sink, bool route)
@@ -425,8 +503,7 @@ void pa_discover_add_sink(struct userdata *u, pa_sink *sink, bool route)
     pa_module         *module;
     mir_node          *node;
     pa_card           *card;
-    const char        *key;
-    char               kbf[256];
+    uint64_t           key;
     char               nbf[2048];
     const char        *loopback_role;
     pa_nodeset_map    *map;
@@ -445,11 +522,15 @@ void pa_discover_add_sink(struct userdata *u, pa_sink *sink, bool route)
     module = sink->module;
 
     if ((card = sink->card)) {
-        if (!(key = node_key(u, mir_output,sink,ACTIVE_PORT, kbf,sizeof(kbf))))
+        /* combine, loopback, null and tunnel sinks do not start a storm */
+        hotplug_begin(u);
+
+        if (!node_key(u, mir_output, sink, ACTIVE_PORT, &key))
             return;
-        if (!(node = pa_discover_find_node_by_key(u, key))) {
+        if (!(node = find_node_by_ikey(u, key))) {
             if (u->state.profile)
-                pa_log_debug("can't find node for sink (key '%s')", key);
+                pa_log_debug("can't find node for sink (key 0x%llx)",
+                             (unsigned long long)key);
             else
                 u->state.sink = sink->index;
             return;
@@ -458,6 +539,7 @@ void pa_discover_add_sink(struct userdata *u, pa_sink *sink, bool route)
                      node->paname, node->key);
         node->paidx = sink->index;
         node->available = true;
+        mir_router_mark_node_dirty(u, node);
         pa_discover_add_node_to_ptr_hash(u, sink, node);
 
         if ((loopback_role = pa_classify_loopback_stream(node))) {
@@ -493,7 +575,7 @@ void pa_discover_add_sink(struct userdata *u, pa_sink *sink, bool route)
             type = node->type;
 
             if (type != mir_bluetooth_a2dp && type != mir_bluetooth_sco)
-                mir_router_make_routing(u);
+                mir_router_make_incremental_routing(u);
             else {
                 if (!u->state.profile)
                     schedule_deferred_routing(u);
@@ -593,14 +675,17 @@ void pa_discover_remove_sink(struct userdata *u, pa_sink *sink)
         pa_murphyif_destroy_resource_set(u, node);
 #endif
         schedule_source_cleanup(u, node);
+        pa_discover_remove_node_from_ptr_hash(u, sink);
         node->paidx = PA_IDXSET_INVALID;
-        pa_hashmap_remove(discover->nodes.byptr, sink);
+        mir_router_mark_node_dirty(u, node);
 
         type = node->type;
 
         if (sink->card) {
-            if (type != mir_bluetooth_a2dp && type != mir_bluetooth_sco)
+            if (type != mir_bluetooth_a2dp && type != mir_bluetooth_sco) {
                 node->available = false;
+                mir_router_mark_node_dirty(u, node);
+            }
             else {
                 if (!u->state.profile)
                     schedule_deferred_routing(u);
@@ -621,8 +706,7 @@ void pa_discover_add_source(struct userdata *u, pa_source *source)
     pa_module         *module;
     mir_node          *node;
     pa_card           *card;
-    const char        *key;
-    char               kbf[256];
+    uint64_t           key;
     char               nbf[2048];
     const char        *loopback_role;
     pa_nodeset_map    *map;
@@ -640,11 +724,14 @@ void pa_discover_add_source(struct userdata *u, pa_source *source)
     module = source->module;
 
     if ((card = source->card)) {
-        if (!(key = node_key(u,mir_input,source,ACTIVE_PORT,kbf,sizeof(kbf))))
+        hotplug_begin(u);
+
+        if (!node_key(u, mir_input, source, ACTIVE_PORT, &key))
             return;
-        if (!(node = pa_discover_find_node_by_key(u, key))) {
+        if (!(node = find_node_by_ikey(u, key))) {
             if (u->state.profile)
-                pa_log_debug("can't find node for source (key '%s')", key);
+                pa_log_debug("can't find node for source (key 0x%llx)",
+                             (unsigned long long)key);
             else
                 u->state.source = source->index;
             return;
@@ -653,6 +740,7 @@ void pa_discover_add_source(struct userdata *u, pa_source *source)
                      node->amname);
         node->paidx = source->index;
         node->available = true;
+        mir_router_mark_node_dirty(u, node);
         pa_discover_add_node_to_ptr_hash(u, source, node);
         if ((loopback_role = pa_classify_loopback_stream(node))) {
             if (!(ns = pa_utils_get_null_sink(u))) {
@@ -685,6 +773,7 @@ void pa_discover_add_source(struct userdata *u, pa_source *source)
             else
                 node->rset.grant = 1;
 #endif
+            pa_fader_mark_zone_dirty(u, node->zone);
             pa_fader_apply_volume_limits(u, node->stamp);
         }
     }
@@ -774,14 +863,17 @@ void pa_discover_remove_source(struct userdata *u, pa_source *source)
         pa_murphyif_destroy_resource_set(u, node);
 #endif
         schedule_source_cleanup(u, node);
+        pa_discover_remove_node_from_ptr_hash(u, source);
         node->paidx = PA_IDXSET_INVALID;
-        pa_hashmap_remove(discover->nodes.byptr, source);
+        mir_router_mark_node_dirty(u, node);
 
         type = node->type;
 
         if (source->card) {
-            if (type != mir_bluetooth_sco)
+            if (type != mir_bluetooth_sco) {
                 node->available = false;
+                mir_router_mark_node_dirty(u, node);
+            }
             else {
                 if (!u->state.profile)
                     schedule_deferred_routing(u);
@@ -1165,12 +1257,13 @@ void pa_discover_add_sink_input(struct userdata *u, pa_sink_input *sinp)
     if (s)
         pa_log_debug("routing target candidate is %u (%s)", s->index, s->name);
 
-    if (!s || !(snod = pa_hashmap_get(discover->nodes.byptr, s)))
+    if (!s || !(snod = pa_discover_find_node_by_sink(u, s)))
         pa_log_debug("can't figure out where this stream is routed");
     else {
         pa_log_debug("register route '%s' => '%s'",
                      node->amname, snod->amname);
 
+        pa_fader_update_stream(u, sinp);
         pa_fader_apply_volume_limits(u, pa_utils_get_stamp());
     }
 }
@@ -1202,21 +1295,27 @@ void pa_discover_remove_sink_input(struct userdata *u, pa_sink_input *sinp)
         pa_log_debug("node found for '%s'. After clearing routes "
                      "it will be destroyed", name);
 
-        if (!(sinknod = pa_hashmap_get(discover->nodes.byptr, sinp->sink)))
+        if (!(sinknod = pa_discover_find_node_by_sink(u, sinp->sink))) {
             pa_log_debug("can't figure out where this stream is routed");
+            mir_router_mark_all_dirty(u);
+        }
         else {
             pa_log_debug("clear route '%s' => '%s'",
                          node->amname, sinknod->amname);
 
             /* FIXME: and actually do it ... */
 
+            mir_router_mark_node_dirty(u, sinknod);
         }
 
         destroy_node(u, node);
     }
 
+    if (!node && had_properties)
+        mir_router_mark_all_dirty(u);
+
     if (node || had_properties)
-        mir_router_make_routing(u);
+        mir_router_make_incremental_routing(u);
 }
 
 void pa_discover_register_source_output(struct userdata  *u,
@@ -1504,7 +1603,7 @@ void pa_discover_add_source_output(struct userdata *u, pa_source_output *sout)
     if ((s = sout->source))
         pa_log_debug("routing target candidate is %u (%s)", s->index, s->name);
 
-    if (!s || !(snod = pa_hashmap_get(discover->nodes.byptr, s)))
+    if (!s || !(snod = pa_discover_find_node_by_source(u, s)))
         pa_log_debug("can't figure out where this stream is routed");
     else {
         pa_log_debug("register route '%s' => '%s'",
@@ -1534,22 +1633,33 @@ void pa_discover_remove_source_output(struct userdata  *u,
         pa_log_debug("node found for '%s'. After clearing routes "
                      "it will be destroyed", name);
 
-        if (!(srcnod = pa_hashmap_get(discover->nodes.byptr, sout->source)))
+        if (!(srcnod = pa_discover_find_node_by_source(u, sout->source))) {
             pa_log_debug("can't figure out where this stream is routed");
+            mir_router_mark_all_dirty(u);
+        }
         else {
             pa_log_debug("clear route '%s' => '%s'",
                          node->amname, srcnod->amname);
 
             /* FIXME: and actually do it ... */
 
+            mir_router_mark_node_dirty(u, srcnod);
         }
 
         destroy_node(u, node);
 
-        mir_router_make_routing(u);
+        mir_router_make_incremental_routing(u);
     }
 }
 
+const pa_discover_work_stats *pa_discover_get_work_stats(struct userdata *u)
+{
+    pa_assert(u);
+    pa_assert(u->discover);
+
+    return &u->discover->work.stats;
+}
+
 mir_node *pa_discover_find_node_by_key(struct userdata *u, const char *key)
 {
     pa_discover *discover;
@@ -1582,29 +1692,216 @@ mir_node *pa_discover_find_node_by_ptr(struct userdata *u, void *ptr)
     return node;
 }
 
+mir_node *pa_discover_find_node_by_sink(struct userdata *u, pa_sink *sink)
+{
+    if (!sink)
+        return NULL;
+
+    return find_node_by_object(u, pa_discover_sink, sink->index, sink);
+}
+
+mir_node *pa_discover_find_node_by_source(struct userdata *u,
+                                          pa_source *source)
+{
+    if (!source)
+        return NULL;
+
+    return find_node_by_object(u, pa_discover_source, source->index, source);
+}
+
+mir_node *pa_discover_find_node_by_sink_input(struct userdata *u,
+                                              pa_sink_input *sinp)
+{
+    if (!sinp)
+        return NULL;
+
+    return find_node_by_object(u, pa_discover_sink_input, sinp->index, sinp);
+}
+
+mir_node *pa_discover_find_node_by_source_output(struct userdata *u,
+                                                 pa_source_output *sout)
+{
+    if (!sout)
+        return NULL;
+
+    return find_node_by_object(u, pa_discover_source_output, sout->index,
+                               sout);
+}
+
 void pa_discover_add_node_to_ptr_hash(struct userdata *u,
                                       void *ptr,
                                       mir_node *node)
 {
     pa_discover *discover;
+    int type;
 
     pa_assert(u);
     pa_assert(ptr);
     pa_assert(node);
     pa_assert_se((discover = u->discover));
 
-    pa_hashmap_put(discover->nodes.byptr, ptr, node);
+    if (pa_hashmap_put(discover->nodes.byptr, ptr, node) < 0)
+        return;
+
+    if ((type = node_object_type(node)) >= 0 &&
+        node->paidx != PA_IDXSET_INVALID)
+    {
+        node_table_set(discover->nodes.bytype + type, node->paidx, ptr, node);
+    }
 }
 
 mir_node *pa_discover_remove_node_from_ptr_hash(struct userdata *u, void *ptr)
 {
     pa_discover *discover;
+    mir_node *node;
+    int type;
 
     pa_assert(u);
     pa_assert(ptr);
     pa_assert_se((discover = u->discover));
 
-    return pa_hashmap_remove(discover->nodes.byptr, ptr);
+    if ((node = pa_hashmap_remove(discover->nodes.byptr, ptr)) &&
+        (type = node_object_type(node)) >= 0)
+    {
+        node_table_clear(discover->nodes.bytype + type, node->paidx, ptr);
+    }
+
+    return node;
+}
+
+static int node_object_type(mir_node *node)
+{
+    if (node->implement == mir_device) {
+        if (node->direction == mir_output)
+            return pa_discover_sink;
+        if (node->direction == mir_input)
+            return pa_discover_source;
+    }
+    else if (node->implement == mir_stream) {
+        if (node->direction == mir_input)
+            return pa_discover_sink_input;
+        if (node->direction == mir_output)
+            return pa_discover_source_output;
+    }
+
+    return -1;
+}
+
+static mir_node *find_node_by_object(struct userdata *u,
+                                     int type,
+                                     uint32_t index,
+                                     void *ptr)
+{
+    pa_discover *discover;
+    pa_discover_node_table *tbl;
+    pa_discover_node_slot *slot;
+
+    pa_assert(u);
+    pa_assert_se((discover = u->discover));
+
+    tbl = discover->nodes.bytype + type;
+
+    if (tbl->size) {
+        slot = tbl->slots + (index & (tbl->size - 1));
+
+        if (slot->ptr == ptr && slot->index == index)
+            return slot->node;
+    }
+
+    /* objects without a node or lost in a collision */
+    return pa_hashmap_get(discover->nodes.byptr, ptr);
+}
+
+static void node_table_set(pa_discover_node_table *tbl,
+                           uint32_t index,
+                           void *ptr,
+                           mir_node *node)
+{
+    pa_discover_node_slot *slot;
+
+    if (!tbl->size && !node_table_grow(tbl))
+        return;
+
+    for (;;) {
+        slot = tbl->slots + (index & (tbl->size - 1));
+
+        if (!slot->ptr || slot->ptr == ptr)
+            break;
+
+        /* collision; the entry stays in the byptr hash only at max size */
+        if (!node_table_grow(tbl))
+            return;
+    }
+
+    if (!slot->ptr)
+        tbl->nslot++;
+
+    slot->ptr   = ptr;
+    slot->index = index;
+    slot->node  = node;
+}
+
+static void node_table_clear(pa_discover_node_table *tbl,
+                             uint32_t index,
+                             void *ptr)
+{
+    pa_discover_node_slot *slot;
+    uint32_t i;
+
+    if (!tbl->size)
+        return;
+
+    if (index != PA_IDXSET_INVALID) {
+        slot = tbl->slots + (index & (tbl->size - 1));
+
+        if (slot->ptr == ptr) {
+            memset(slot, 0, sizeof(*slot));
+            tbl->nslot--;
+        }
+
+        return;
+    }
+
+    /* the index of the node was reset before; look for the object */
+    for (i = 0;  i < tbl->size;  i++) {
+        slot = tbl->slots + i;
+
+        if (slot->ptr == ptr) {
+            memset(slot, 0, sizeof(*slot));
+            tbl->nslot--;
+            return;
+        }
+    }
+}
+
+static bool node_table_grow(pa_discover_node_table *tbl)
+{
+    pa_discover_node_slot *slots, *old;
+    uint32_t size, i;
+
+    if (!tbl->size)
+        size = PA_DISCOVER_NODE_TABLE_MIN;
+    else if (tbl->size < PA_DISCOVER_NODE_TABLE_MAX)
+        size = tbl->size * 2;
+    else
+        return false;
+
+    slots = pa_xnew0(pa_discover_node_slot, size);
+
+    /* distinct slots of the old table map to distinct slots of the new */
+    for (i = 0;  i < tbl->size;  i++) {
+        old = tbl->slots + i;
+
+        if (old->ptr)
+            slots[old->index & (size - 1)] = *old;
+    }
+
+    pa_xfree(tbl->slots);
+
+    tbl->slots = slots;
+    tbl->size  = size;
+
+    return true;
 }
 
 static void handle_alsa_card(struct userdata *u, pa_card *card)
@@ -1713,6 +2010,7 @@ static void handle_bluetooth_card(struct userdata *u, pa_card *card)
                     amname[0] = '\0';
                     snprintf(paname, sizeof(paname), "bluez_sink.%s", cid);
                     snprintf(key, sizeof(key), "%s@%s.%s", paname, port->name, prof->name);
+                    data.ikey = make_node_key(u, paname, port->name, prof->name);
                     pa_classify_node_by_card(&data, card, prof, NULL);
                     node = create_node(u, &data, NULL);
                     mir_constrain_add_node(u, cd, node);
@@ -1726,6 +2024,7 @@ static void handle_bluetooth_card(struct userdata *u, pa_card *card)
                     amname[0] = '\0';
                     snprintf(paname, sizeof(paname), "bluez_source.%s", cid);
                     snprintf(key, sizeof(key), "%s@%s.%s", paname, port->name, prof->name);
+                    data.ikey = make_node_key(u, paname, port->name, prof->name);
                     pa_classify_node_by_card(&data, card, prof, NULL);
                     node = create_node(u, &data, NULL);
                     mir_constrain_add_node(u, cd, node);
@@ -1873,6 +2172,7 @@ static void handle_card_ports(struct userdata *u, mir_node *data,
                 snprintf(key, sizeof(key), "%s@%s", data->paname, port->name);
 
                 data->key       = key;
+                data->ikey      = make_node_key(u, data->paname, port->name, NULL);
                 data->available = (port->available != PA_AVAILABLE_NO);
                 data->type      = 0;
                 data->amname    = amname;
@@ -1894,7 +2194,8 @@ static void handle_card_ports(struct userdata *u, mir_node *data,
     }
 
     if (!have_ports) {
-        data->key = pa_xstrdup(data->paname);
+        data->key = (char *)data->paname; /* the node copies it */
+        data->ikey = make_node_key(u, data->paname, NULL, NULL);
         data->available = true;
 
         pa_classify_node_by_card(data, card, prof, NULL);
@@ -1913,6 +2214,7 @@ static mir_node *create_node(struct userdata *u, mir_node *data,
                              bool *created_ret)
 {
     pa_discover *discover;
+    pa_discover_card_nodes *cn;
     mir_node    *node;
     bool    created;
     char         buf[2048];
@@ -1931,6 +2233,14 @@ static mir_node *create_node(struct userdata *u, mir_node *data,
         node = mir_node_create(u, data);
         pa_hashmap_put(discover->nodes.byname, node->key, node);
 
+        if (node->ikey)
+            pa_hashmap_put(discover->nodes.bykey, &node->ikey, node);
+
+        if (node->implement == mir_device && node->pacard.profile) {
+            cn = get_card_nodes(u, node->pacard.index, true);
+            MIR_DLIST_APPEND(mir_node,cardchain, node, &cn->nodes);
+        }
+
         mir_node_print(node, buf, sizeof(buf));
         pa_log_debug("new node:\n%s", buf);
     }
@@ -1965,6 +2275,12 @@ static void destroy_node(struct userdata *u, mir_node *node)
 
         pa_log_debug("destroying node: %s / '%s'", node->key, node->amname);
 
+        if (node->ikey && pa_hashmap_get(discover->nodes.bykey, &node->ikey) == node)
+            pa_hashmap_remove(discover->nodes.bykey, &node->ikey);
+
+        /* the card entry itself goes when the card is removed */
+        MIR_DLIST_UNLINK(mir_node,cardchain, node);
+
         if (node->implement == mir_stream) {
             if (node->direction == mir_input) {
                 if (node->mux) {
@@ -1996,6 +2312,7 @@ static bool update_node_availability(struct userdata *u,
     {
         node->available = available;
 
+        mir_router_mark_node_dirty(u, node);
         extapi_signal_node_change(u);
 
         return true; /* routing needed */
@@ -2004,33 +2321,24 @@ static bool update_node_availability(struct userdata *u,
     return false;
 }
 
-static bool update_node_availability_by_device(struct userdata *u,
-                                                    mir_direction direction,
-                                                    void *data,
-                                                    pa_device_port *port,
-                                                    bool available)
+static pa_discover_card_nodes *get_card_nodes(struct userdata *u,
+                                              uint32_t card_index,
+                                              bool create)
 {
-    mir_node   *node;
-    const char *key;
-    char        buf[256];
+    pa_discover *discover = u->discover;
+    pa_discover_card_nodes *cn;
 
-    pa_assert(u);
-    pa_assert(data);
-    pa_assert(port);
-    pa_assert(direction == mir_input || direction == mir_output);
+    cn = pa_hashmap_get(discover->nodes.bycard, PA_UINT32_TO_PTR(card_index));
 
-    if ((key = node_key(u, direction, data, port, buf, sizeof(buf)))) {
-        if (!(node = pa_discover_find_node_by_key(u, key)))
-            pa_log_debug("      can't find node (key '%s')", key);
-        else {
-            pa_log_debug("      node for '%s' found (key %s)",
-                         node->paname, node->key);
+    if (!cn && create) {
+        cn = pa_xnew0(pa_discover_card_nodes, 1);
+        cn->index = card_index;
+        MIR_DLIST_INIT(cn->nodes);
 
-            return update_node_availability(u, node, available);
-        }
+        pa_hashmap_put(discover->nodes.bycard, PA_UINT32_TO_PTR(card_index), cn);
     }
 
-    return false; /* no routing needed */
+    return cn;
 }
 
 static char *get_name(char **string_ptr, int offs)
@@ -2094,8 +2402,13 @@ static void parse_profile_name(pa_card_profile *prof,
     } while (*p);
 }
 
-static const char *node_key(struct userdata *u, mir_direction direction,
-                      void *data, pa_device_port *port, char *buf, size_t len)
+/*
+ * The key of a card device node is composed of the interned ids of its
+ * sink/source, port and profile names. Nothing is interned here: a name
+ * that was never seen can't belong to any node and yields the key 0.
+ */
+static bool node_key(struct userdata *u, mir_direction direction,
+                     void *data, pa_device_port *port, uint64_t *key_ret)
 {
     pa_card         *card;
     pa_card_profile *profile;
@@ -2104,19 +2417,21 @@ static const char *node_key(struct userdata *u, mir_direction direction,
     bool             usb;
     bool             bluetooth;
     bool             platform;
-    char            *type;
+    const char      *type;
     const char      *name;
     const char      *profile_name;
-    const char      *key;
+    uint32_t         nid, pid, fid;
 
     pa_assert(u);
     pa_assert(data);
-    pa_assert(buf);
+    pa_assert(key_ret);
     pa_assert(direction == mir_input || direction == mir_output);
 
+    *key_ret = 0;
+
     if (direction == mir_output) {
         pa_sink *sink = data;
-        type = pa_xstrdup("sink");
+        type = "sink";
         name = pa_utils_get_sink_name(sink);
         card = sink->card;
         if (!port)
@@ -2124,7 +2439,7 @@ static const char *node_key(struct userdata *u, mir_direction direction,
     }
     else {
         pa_source *source = data;
-        type = pa_xstrdup("source");
+        type = "source";
         name = pa_utils_get_source_name(source);
         card = source->card;
         if (!port)
@@ -2132,7 +2447,7 @@ static const char *node_key(struct userdata *u, mir_direction direction,
     }
 
     if (!card)
-        return NULL;
+        return false;
 
     pa_assert_se((profile = card->active_profile));
 
@@ -2148,7 +2463,7 @@ static const char *node_key(struct userdata *u, mir_direction direction,
     if (!(bus = pa_utils_get_card_bus(card))) {
         pa_log_debug("ignoring %s '%s' due to lack of '%s' property "
                      "on its card", type, name, PA_PROP_DEVICE_BUS);
-        return NULL;
+        return false;
     }
 
     pci = pa_streq(bus, "pci");
@@ -2159,27 +2474,86 @@ static const char *node_key(struct userdata *u, mir_direction direction,
     if (!pci && !usb && !bluetooth && !platform) {
         pa_log_debug("ignoring %s '%s' due to unsupported bus type '%s' "
                      "of its card", type, name, bus);
-        return NULL;
+        return false;
     }
 
-    if (bluetooth) {
-        if (!port)
-            key = NULL;
-        else {
-            key = buf;
-            snprintf(buf, len, "%s@%s.%s", name, port->name, profile_name);
-        }
-    }
-    else {
-        if (!port)
-            key = name;
-        else {
-            key = buf;
-            snprintf(buf, len, "%s@%s", name, port->name);
-        }
+    if (bluetooth && !port)
+        return false;
+
+    nid = name_id(u, name, false);
+    pid = port ? name_id(u, port->name, false) : 0;
+    fid = bluetooth ? name_id(u, profile_name, false) : 0;
+
+    if (nid && (!port || pid) && (!bluetooth || fid)) {
+        *key_ret = ((uint64_t)nid << (2 * PA_DISCOVER_NAME_ID_BITS)) |
+                   ((uint64_t)pid << PA_DISCOVER_NAME_ID_BITS) | fid;
     }
 
-    return key;
+    return true;
+}
+
+static uint64_t make_node_key(struct userdata *u,
+                              const char *name,
+                              const char *port,
+                              const char *profile)
+{
+    uint32_t nid, pid, fid;
+
+    if (!(nid = name_id(u, name, true)))
+        return 0;
+
+    pid = port ? name_id(u, port, true) : 0;
+    fid = profile ? name_id(u, profile, true) : 0;
+
+    if ((port && !pid) || (profile && !fid))
+        return 0;
+
+    return ((uint64_t)nid << (2 * PA_DISCOVER_NAME_ID_BITS)) |
+           ((uint64_t)pid << PA_DISCOVER_NAME_ID_BITS) | fid;
+}
+
+static uint32_t name_id(struct userdata *u, const char *name, bool create)
+{
+    pa_discover *discover = u->discover;
+    uint32_t id;
+
+    if (!name)
+        return 0;
+
+    if ((id = PA_PTR_TO_UINT32(pa_hashmap_get(discover->names.ids, name))))
+        return id;
+
+    if (!create || discover->names.nid >= PA_DISCOVER_NAME_ID_MAX)
+        return 0;
+
+    id = ++discover->names.nid;
+    pa_hashmap_put(discover->names.ids, pa_xstrdup(name),
+                   PA_UINT32_TO_PTR(id));
+
+    return id;
+}
+
+static mir_node *find_node_by_ikey(struct userdata *u, uint64_t key)
+{
+    if (!key)
+        return NULL;
+
+    return pa_hashmap_get(u->discover->nodes.bykey, &key);
+}
+
+static unsigned node_key_hash(const void *p)
+{
+    uint64_t key = *(const uint64_t *)p;
+
+    return (unsigned)(key ^ (key >> 21) ^ (key >> 42));
+}
+
+static int node_key_compare(const void *a, const void *b)
+{
+    uint64_t ka = *(const uint64_t *)a;
+    uint64_t kb = *(const uint64_t *)b;
+
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
 }
 
 static pa_sink *make_output_prerouting(struct userdata *u,
@@ -2385,35 +2759,174 @@ static void set_bluetooth_profile(struct userdata *u,
     }
 }
 
-static void deferred_routing_cb(pa_mainloop_api *m, void *d)
+static void schedule_deferred_routing(struct userdata *u)
 {
-    struct userdata *u = d;
+    pa_assert(u);
 
-    (void)m;
+    pa_log_debug("scheduling deferred routing");
+
+    schedule_work(u, pa_discover_work_routing, 0);
+}
 
+static void schedule_card_check(struct userdata *u, pa_card *card)
+{
     pa_assert(u);
+    pa_assert(card);
 
-    pa_log_debug("deferred routing starts");
+    pa_log_debug("scheduling card check");
 
-    mir_router_make_routing(u);
+    schedule_work(u, pa_discover_work_card_check, card->index);
 }
 
-static void schedule_deferred_routing(struct userdata *u)
+static void schedule_source_cleanup(struct userdata *u, mir_node *node)
 {
-    pa_core *core;
+    deferred_work_t *work;
 
     pa_assert(u);
-    pa_assert_se((core = u->core));
+    pa_assert(node);
 
-    pa_log_debug("scheduling deferred routing");
+    if (!node->mux && !node->loop)
+        return;
+
+    pa_log_debug("scheduling source cleanup");
+
+    work = schedule_work(u, pa_discover_work_source_cleanup, node->index);
+
+    /* a pending cleanup of the node can't take over another mux or loop */
+    if ((work->mux && node->mux) || (work->loop && node->loop))
+        work = queue_work(u, pa_discover_work_source_cleanup, node->index,
+                          false);
+
+    if (node->mux)
+        work->mux = node->mux;
+    if (node->loop)
+        work->loop = node->loop;
+
+    node->mux = NULL;
+    node->loop = NULL;
+}
 
-    pa_mainloop_api_once(core->mainloop, deferred_routing_cb, u);
+static deferred_work_t *schedule_work(struct userdata *u,
+                                      enum pa_discover_work_kind kind,
+                                      uint32_t object)
+{
+    pa_discover *discover;
+    pa_discover_workq *wq;
+    deferred_work_t *work;
+    uint64_t key;
+
+    pa_assert(u);
+    pa_assert(kind < pa_discover_work_max);
+    pa_assert_se((discover = u->discover));
+
+    wq  = &discover->work;
+    key = WORK_KEY(kind, object);
+
+    wq->stats.scheduled++;
+
+    if ((work = pa_hashmap_get(wq->pending, &key))) {
+        wq->stats.deduped[kind]++;
+        return work;
+    }
+
+    return queue_work(u, kind, object, true);
 }
 
-static void card_check_cb(pa_mainloop_api *m, void *d)
+static deferred_work_t *queue_work(struct userdata *u,
+                                   enum pa_discover_work_kind kind,
+                                   uint32_t object,
+                                   bool pending)
+{
+    pa_discover *discover;
+    pa_discover_workq *wq;
+    deferred_work_t *work;
+
+    pa_assert(u);
+    pa_assert_se((discover = u->discover));
+
+    wq = &discover->work;
+
+    work = pa_xnew0(deferred_work_t, 1);
+    work->key    = WORK_KEY(kind, object);
+    work->kind   = kind;
+    work->object = object;
+
+    if (pending)
+        work->pending = (pa_hashmap_put(wq->pending, &work->key, work) == 0);
+
+    MIR_DLIST_APPEND(deferred_work_t, link, work, &wq->queue[kind]);
+
+    if (++wq->stats.depth > wq->stats.maxdepth)
+        wq->stats.maxdepth = wq->stats.depth;
+
+    u->core->mainloop->defer_enable(wq->defer, 1);
+
+    return work;
+}
+
+static void work_event_cb(pa_mainloop_api *m, pa_defer_event *e, void *d)
+{
+    struct userdata *u = d;
+    pa_discover *discover;
+    pa_discover_workq *wq;
+    mir_dlist batch[pa_discover_work_max];
+    deferred_work_t *work, *n;
+    uint32_t nwork;
+    int kind;
+
+    pa_assert(u);
+    pa_assert_se((discover = u->discover));
+
+    m->defer_enable(e, 0);
+
+    wq = &discover->work;
+
+    /* whatever the batch schedules is left for the next one */
+    for (kind = 0;  kind < pa_discover_work_max;  kind++) {
+        MIR_DLIST_INIT(batch[kind]);
+
+        MIR_DLIST_FOR_EACH_SAFE(deferred_work_t,link, work,n, &wq->queue[kind]){
+            MIR_DLIST_UNLINK(deferred_work_t, link, work);
+
+            if (work->pending)
+                pa_hashmap_remove(wq->pending, &work->key);
+
+            MIR_DLIST_APPEND(deferred_work_t, link, work, &batch[kind]);
+        }
+    }
+
+    nwork = wq->stats.depth;
+    wq->stats.depth = 0;
+    wq->stats.batches++;
+
+    pa_log_debug("dispatching %u deferred work item(s)", nwork);
+
+    /* sources are cleaned up and cards checked before routing */
+    for (kind = 0;  kind < pa_discover_work_max;  kind++) {
+        MIR_DLIST_FOR_EACH_SAFE(deferred_work_t,link, work,n, &batch[kind]) {
+            MIR_DLIST_UNLINK(deferred_work_t, link, work);
+
+            switch (work->kind) {
+            case pa_discover_work_source_cleanup:
+                cleanup_source(u, work);
+                break;
+            case pa_discover_work_card_check:
+                check_card(u, work->object);
+                break;
+            case pa_discover_work_routing:
+                mir_router_make_routing(u);
+                break;
+            default:
+                break;
+            }
+
+            pa_xfree(work);
+        }
+    }
+}
+
+static void check_card(struct userdata *u, uint32_t index)
 {
-    card_check_t *cc = d;
-    struct userdata *u;
     pa_core *core;
     pa_card *card;
     pa_sink *sink;
@@ -2421,16 +2934,13 @@ static void card_check_cb(pa_mainloop_api *m, void *d)
     int n_sink, n_source;
     uint32_t idx;
 
-    (void)m;
-
-    pa_assert(cc);
-    pa_assert((u = cc->u));
-    pa_assert((core = u->core));
+    pa_assert(u);
+    pa_assert_se((core = u->core));
 
     pa_log_debug("card check starts");
 
-    if (!(card = pa_idxset_get_by_index(core->cards, cc->index)))
-        pa_log_debug("card %u is gone", cc->index);
+    if (!(card = pa_idxset_get_by_index(core->cards, index)))
+        pa_log_debug("card %u is gone", index);
     else {
         n_sink = n_source = 0;
 
@@ -2455,70 +2965,118 @@ static void card_check_cb(pa_mainloop_api *m, void *d)
             mir_router_make_routing(u);
         }
     }
+}
+
+static void cleanup_source(struct userdata *u, deferred_work_t *work)
+{
+    pa_assert(u);
+    pa_assert(work);
+
+    pa_log_debug("source cleanup starts");
+
+    pa_loopback_destroy(u->loopback, u->core, work->loop);
+    pa_multiplex_destroy(u->multiplex, u->core, work->mux);
 
-    pa_xfree(cc);
+    pa_log_debug("source cleanup ends");
 }
 
-static void schedule_card_check(struct userdata *u, pa_card *card)
+static void hotplug_begin(struct userdata *u)
 {
     pa_core *core;
-    card_check_t *cc;
+    pa_discover *discover;
+    pa_discover_hotplug *hp;
+    pa_usec_t now, when;
 
     pa_assert(u);
-    pa_assert(card);
     pa_assert_se((core = u->core));
+    pa_assert_se((discover = u->discover));
 
-    pa_log_debug("scheduling card check");
+    hp  = &discover->hotplug;
+    now = pa_rtclock_now();
+
+    /*
+     * the devices of a storm are registered to the routing groups in
+     * bulk and routed by a single pass when the storm has settled
+     */
+    if (!hp->start) {
+        hp->start = now;
+        mir_router_hold_routing(u);
+    }
 
-    cc = pa_xnew0(card_check_t, 1);
-    cc->u = u;
-    cc->index = card->index;
+    hp->ndevice++;
 
-    pa_mainloop_api_once(core->mainloop, card_check_cb, cc);
+    if (!hp->window) {
+        core->mainloop->defer_enable(hp->defer, 1);
+        return;
+    }
+
+    when = now + hp->window;
+
+    if (when > hp->start + HOTPLUG_MAX_WINDOWS * hp->window)
+        when = hp->start + HOTPLUG_MAX_WINDOWS * hp->window;
+
+    if (!hp->timer)
+        hp->timer = pa_core_rttime_new(core, when, hotplug_timer_cb, u);
+    else
+        pa_core_rttime_restart(core, hp->timer, when);
 }
 
-static void source_cleanup_cb(pa_mainloop_api *m, void *d)
+static void hotplug_settled(struct userdata *u)
 {
-    source_cleanup_t *sc = d;
-    struct userdata *u;
-    pa_core *core;
+    pa_discover *discover;
+    pa_discover_hotplug *hp;
+    pa_usec_t start;
 
-    (void)m;
+    pa_assert(u);
+    pa_assert_se((discover = u->discover));
 
-    pa_assert(sc);
-    pa_assert((u = sc->u));
-    pa_assert((core = u->core));
+    hp = &discover->hotplug;
 
-    pa_log_debug("source cleanup starts");
+    if (!(start = hp->start))
+        return;
 
-    pa_loopback_destroy(u->loopback, u->core, sc->loop);
-    pa_multiplex_destroy(u->multiplex, u->core, sc->mux);
+    hp->settle = pa_rtclock_now() - start;
+    hp->storms++;
+    hp->devices += hp->ndevice;
 
-    pa_log_debug("source cleanup ends");
+    if (hp->settle > hp->maxsettle)
+        hp->maxsettle = hp->settle;
+
+    pa_log_debug("hotplug storm of %u device event(s) settled in %lu usec "
+                 "(max. %lu usec)", hp->ndevice, (unsigned long)hp->settle,
+                 (unsigned long)hp->maxsettle);
 
-    pa_xfree(sc);
+    hp->start = 0;
+    hp->ndevice = 0;
+
+    /* hotplug to routed audio is reported by the router's event latency */
+    if (mir_router_release_routing(u))
+        mir_router_note_device_event(u, start);
 }
 
-static void schedule_source_cleanup(struct userdata *u, mir_node *node)
+static void hotplug_timer_cb(pa_mainloop_api *m, pa_time_event *e,
+                             const struct timeval *t, void *userdata)
 {
-    pa_core *core;
-    source_cleanup_t *sc;
+    struct userdata *u = userdata;
+
+    (void)m;
+    (void)e;
+    (void)t;
 
     pa_assert(u);
-    pa_assert(node);
-    pa_assert_se((core = u->core));
 
-    pa_log_debug("scheduling source cleanup");
+    hotplug_settled(u);
+}
+
+static void hotplug_defer_cb(pa_mainloop_api *m, pa_defer_event *e, void *d)
+{
+    struct userdata *u = d;
 
-    sc = pa_xnew0(source_cleanup_t, 1);
-    sc->u = u;
-    sc->mux = node->mux;
-    sc->loop = node->loop;
+    pa_assert(u);
 
-    node->mux = NULL;
-    node->loop = NULL;
+    m->defer_enable(e, 0);
 
-    pa_mainloop_api_once(core->mainloop, source_cleanup_cb, sc);
+    hotplug_settled(u);
 }
 
 /*
@@ -24,10 +24,82 @@
 #include <regex.h>
 
 #include "userdata.h"
+#include "list.h"
 
 
 #define PA_BIT(a)      (1UL << (a))
 
+#define PA_DISCOVER_NODE_TABLE_MIN   16
+#define PA_DISCOVER_NODE_TABLE_MAX   4096
+
+#define PA_DISCOVER_NAME_ID_BITS     21
+#define PA_DISCOVER_NAME_ID_MAX      ((1U << PA_DISCOVER_NAME_ID_BITS) - 1)
+
+enum pa_discover_object {
+    pa_discover_sink = 0,
+    pa_discover_source,
+    pa_discover_sink_input,
+    pa_discover_source_output,
+    pa_discover_object_max
+};
+
+typedef struct {
+    void       *ptr;      /**< the PA object; guards against index reuse */
+    uint32_t    index;    /**< PA index of the object */
+    mir_node   *node;
+} pa_discover_node_slot;
+
+typedef struct {
+    uint32_t    index;    /**< card index */
+    mir_dlist   nodes;    /**< device nodes of the card (node: cardchain) */
+} pa_discover_card_nodes;
+
+typedef struct {
+    pa_discover_node_slot *slots; /**< indexed by PA index & (size - 1) */
+    uint32_t               size;  /**< power of 2 */
+    uint32_t               nslot; /**< slots in use */
+} pa_discover_node_table;
+
+enum pa_discover_work_kind {
+    pa_discover_work_source_cleanup = 0,
+    pa_discover_work_card_check,
+    pa_discover_work_routing,
+    pa_discover_work_max
+};
+
+typedef struct {
+    uint32_t    scheduled;  /**< work items asked for */
+    uint32_t    deduped[pa_discover_work_max]; /**< work items merged into a
+                                                    pending one of the same
+                                                    kind and object */
+    uint32_t    batches;    /**< number of dispatched batches */
+    uint32_t    depth;      /**< work items pending */
+    uint32_t    maxdepth;
+} pa_discover_work_stats;
+
+typedef struct {
+    pa_defer_event        *defer;   /**< dispatches the pending work */
+    pa_hashmap            *pending; /**< pending work by kind and object */
+    mir_dlist              queue[pa_discover_work_max]; /**< pending work
+                                                             in the order
+                                                             it came */
+    pa_discover_work_stats stats;
+} pa_discover_workq;
+
+typedef struct {
+    pa_usec_t       window;   /**< quiet time that ends a hotplug storm;
+                                   with 0 only the device appearances of
+                                   the same mainloop iteration are merged */
+    pa_time_event  *timer;    /**< ends the storm after the window */
+    pa_defer_event *defer;    /**< ends the storm if there is no window */
+    pa_usec_t       start;    /**< first device event of the storm or 0 */
+    uint32_t        ndevice;  /**< device events in the current storm */
+    uint32_t        storms;   /**< number of storms settled */
+    uint32_t        devices;  /**< device events in all settled storms */
+    pa_usec_t       settle;   /**< duration of the last storm */
+    pa_usec_t       maxsettle;
+} pa_discover_hotplug;
+
 #if 0
 enum pa_bus_type {
     pa_bus_unknown = 0,
@@ -63,14 +135,23 @@ struct pa_discover {
     bool       selected; /**< for alsa cards: whether to consider the
                                    selected profile alone.
                                    for bluetooth cards: no effect */
+    struct {
+        pa_hashmap *ids;    /**< interned sink/port/profile names */
+        uint32_t    nid;    /**< the last id given out */
+    }               names;
     struct {
         pa_hashmap *byname;
         pa_hashmap *byptr;
+        pa_hashmap *bykey;  /**< card devices by their interned key */
+        pa_hashmap *bycard; /**< pa_discover_card_nodes by card index */
+        pa_discover_node_table bytype[pa_discover_object_max];
     }               nodes;
+    pa_discover_hotplug hotplug; /**< coalescing of device appearances */
+    pa_discover_workq   work;    /**< deferred work of the module */
 };
 
 
-struct pa_discover *pa_discover_init(struct userdata *);
+struct pa_discover *pa_discover_init(struct userdata *, const char *);
 void  pa_discover_done(struct userdata *);
 
 void pa_discover_domain_up(struct userdata *);
@@ -100,9 +181,17 @@ bool pa_discover_preroute_source_output(struct userdata *,
 void pa_discover_add_source_output(struct userdata *, pa_source_output *);
 void pa_discover_remove_source_output(struct userdata *, pa_source_output *);
 
+const pa_discover_work_stats *pa_discover_get_work_stats(struct userdata *);
+
 
 mir_node *pa_discover_find_node_by_key(struct userdata *, const char *);
 mir_node *pa_discover_find_node_by_ptr(struct userdata *, void *);
+mir_node *pa_discover_find_node_by_sink(struct userdata *, pa_sink *);
+mir_node *pa_discover_find_node_by_source(struct userdata *, pa_source *);
+mir_node *pa_discover_find_node_by_sink_input(struct userdata *,
+                                              pa_sink_input *);
+mir_node *pa_discover_find_node_by_source_output(struct userdata *,
+                                                 pa_source_output *);
 
 void pa_discover_add_node_to_ptr_hash(struct userdata *, void *, mir_node *);
 mir_node *pa_discover_remove_node_from_ptr_hash(struct userdata *, void *);
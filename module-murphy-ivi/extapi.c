@@ -35,6 +35,7 @@
 #include "extapi.h"
 #include "node.h"
 #include "router.h"
+#include "trace.h"
 
 enum {
     SUBCOMMAND_TEST,
@@ -42,7 +43,9 @@ enum {
     SUBCOMMAND_CONNECT,
     SUBCOMMAND_DISCONNECT,
     SUBCOMMAND_SUBSCRIBE,
-    SUBCOMMAND_EVENT
+    SUBCOMMAND_EVENT,
+    SUBCOMMAND_TRACE,
+    SUBCOMMAND_TRACE_DUMP
 };
 
 struct pa_nodeset {
@@ -291,6 +294,38 @@ int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connection *c, u
         break;
     }
 
+    case SUBCOMMAND_TRACE: {
+        const char *subsystems;
+
+        if (pa_tagstruct_gets(t, &subsystems) < 0 ||
+            !subsystems || !pa_tagstruct_eof(t))
+            goto fail;
+
+        pa_log_debug("trace '%s' called in module-murphy-ivi", subsystems);
+
+        if (pa_trace_enable(u, subsystems) < 0)
+            goto fail;
+
+        pa_tagstruct_putu32(reply, pa_trace_get_mask(u));
+        break;
+    }
+
+    case SUBCOMMAND_TRACE_DUMP: {
+        void *dump;
+        size_t size;
+
+        if (!pa_tagstruct_eof(t))
+            goto fail;
+
+        pa_log_debug("trace dump called in module-murphy-ivi");
+
+        /* decoded offline with 'mir-route-sim -d' */
+        dump = pa_trace_dump(u, &size);
+        pa_tagstruct_put_arbitrary(reply, dump, size);
+        pa_xfree(dump);
+        break;
+    }
+
     default:
       goto fail;
   }
@@ -30,29 +30,128 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/sink-input.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/core-rtclock.h>
 
 #include "fader.h"
 #include "node.h"
 #include "discover.h"
 #include "volume.h"
+#include "multiplex.h"
+#include "zone.h"
+#include "trace.h"
 #include "utils.h"
 
+/* dB values on this grid are converted with a table lookup */
+#define DB_TABLE_STEPS          2       /* steps per dB */
+#define DB_TABLE_MIN            MIR_VOLUME_MAX_ATTENUATION
+#define DB_TABLE_MAX            30
+#define DB_TABLE_SIZE           ((DB_TABLE_MAX - DB_TABLE_MIN) * \
+                                 DB_TABLE_STEPS + 1)
+
 typedef struct {
     long fade_out;
     long fade_in;
 } transition_time;
 
 
+typedef struct {
+    uint32_t  sink;        /**< index of the sink the stream was counted on */
+    int       class;       /**< class of the stream; 0 if not counted */
+} stream_mask;
+
+typedef struct {
+    uint32_t    nstream;   /**< number of streams on the sink */
+    uint32_t    count[mir_application_class_end]; /**< active streams/class */
+    uint32_t    mask;      /**< class bits of the active streams */
+    bool        dirty;     /**< streams changed since the limits were applied*/
+    pa_volume_t offload;   /**< limit moved to the sink or PA_VOLUME_NORM */
+    pa_cvolume  base;      /**< soft volume of the sink without the limit */
+    pa_cvolume  applied;   /**< soft volume of the sink with the limit */
+} sink_mask;
+
+typedef struct {
+    pa_volume_t  from;     /**< volume the ramp started from */
+    pa_volume_t  target;   /**< volume the ramp is heading to */
+    pa_usec_t    start;    /**< when the ramp was started */
+    pa_usec_t    length;   /**< length of the ramp; 0 if not ramping */
+} stream_ramp;
+
+typedef struct {
+    uint32_t  started;     /**< ramps sent to the streams */
+    uint32_t  merged;      /**< ramps continuing an unfinished one */
+    uint32_t  suppressed;  /**< ramps to where the stream is heading anyway */
+} ramp_stats;
+
+typedef struct {
+    pa_sink_input *sinp;
+    pa_cvolume     soft_volume;
+} volume_batch_entry;
+
+typedef struct {
+    pa_sink            *sink;     /**< sink of the collected volumes */
+    size_t              nentry;
+    size_t              maxentry;
+    volume_batch_entry *entries;
+} volume_batch;
+
 struct pa_fader {
     transition_time transit;
+    bool            offload;  /**< move common stream limits to the sink */
+    pa_hashmap     *streams;  /**< stream_mask by sink-input index */
+    pa_hashmap     *sinks;    /**< sink_mask by sink index */
+    uint32_t        dirtyzones;/**< bits of the zones to be revisited */
+    bool            alldirty; /**< revisit every sink */
+    pa_fader_stats  stats;
+    pa_hashmap     *ramps;    /**< stream_ramp by sink-input index */
+    ramp_stats      rstats;
+    pa_msgobject   *batchobj; /**< receiver of the batches in the IO thread */
+    volume_batch    batch;    /**< soft volumes waiting to be sent */
+    pa_volume_t     dBtable[DB_TABLE_SIZE]; /**< volumes of the dB grid */
 };
 
+#define VOLUME_BATCH_BUCKET     16
+#define VOLUME_BATCH_MESSAGE    0
+
+static bool zone_is_dirty(struct userdata *, const char *);
+static void update_stream_mask(struct userdata *, pa_sink_input *);
+static void count_stream(struct userdata *, uint32_t, int, int);
+static bool common_stream_limit(struct userdata *, pa_sink *, mir_node *,
+                                uint32_t, uint32_t, double *);
+static void set_sink_limit(pa_sink *, sink_mask *, pa_volume_t);
+
 static void set_stream_volume_limit(struct userdata *, pa_sink_input *,
                                     pa_volume_t, long);
-
-pa_fader *pa_fader_init(const char *fade_out_str, const char *fade_in_str)
+static pa_volume_t volume_from_dB(pa_fader *, double);
+static stream_ramp *get_stream_ramp(pa_fader *, pa_sink_input *);
+static pa_volume_t ramp_current_volume(stream_ramp *, pa_usec_t);
+static void schedule_ramp(pa_fader *, pa_sink_input *, pa_volume_t, long);
+static void batch_soft_volume(pa_fader *, pa_sink_input *);
+static void flush_soft_volumes(pa_fader *);
+static int batch_process_msg(pa_msgobject *, int, void *, int64_t,
+                             pa_memchunk *);
+
+pa_fader *pa_fader_init(const char *fade_out_str,
+                        const char *fade_in_str,
+                        bool offload)
 {
     pa_fader *fader = pa_xnew0(pa_fader, 1);
+    int i;
+
+    for (i = 0;  i < DB_TABLE_SIZE;  i++) {
+        fader->dBtable[i] = pa_sw_volume_from_dB(DB_TABLE_MIN +
+                                                 (double)i / DB_TABLE_STEPS);
+    }
+
+    fader->streams = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                    pa_idxset_trivial_compare_func);
+    fader->sinks   = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                    pa_idxset_trivial_compare_func);
+    fader->ramps   = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                    pa_idxset_trivial_compare_func);
+
+    fader->batchobj = pa_msgobject_new(pa_msgobject);
+    fader->batchobj->process_msg = batch_process_msg;
 
     if (!fade_out_str || pa_atol(fade_out_str, &fader->transit.fade_out) < 0)
         fader->transit.fade_out = 100;
@@ -69,13 +168,43 @@ pa_fader *pa_fader_init(const char *fade_out_str, const char *fade_in_str)
     pa_log_info("fader transition times: out %ld ms, in %ld ms",
                 fader->transit.fade_out, fader->transit.fade_in);
 
+    /* the soft volume of a sink can't be ramped */
+    if (offload && fader->transit.fade_out > 0 && fader->transit.fade_in > 0) {
+        pa_log_info("volume offload needs fade_out=0 or fade_in=0. "
+                    "Not offloading");
+        offload = false;
+    }
+
+    fader->offload = offload;
+
     return fader;
 }
 
 void pa_fader_done(struct userdata *u)
 {
-    if (u) {
-        pa_xfree(u->fader);
+    pa_fader *fader;
+    void *e;
+
+    if (u && (fader = u->fader)) {
+        while ((e = pa_hashmap_steal_first(fader->streams)))
+            pa_xfree(e);
+        pa_hashmap_free(fader->streams);
+
+        while ((e = pa_hashmap_steal_first(fader->sinks)))
+            pa_xfree(e);
+        pa_hashmap_free(fader->sinks);
+
+        while ((e = pa_hashmap_steal_first(fader->ramps)))
+            pa_xfree(e);
+        pa_hashmap_free(fader->ramps);
+
+        /* batches are sent synchronously; none can be pending here */
+        pa_msgobject_unref(fader->batchobj);
+        pa_xfree(fader->batch.entries);
+
+        pa_xfree(fader);
+
+        u->fader = NULL;
     }
 }
 
@@ -84,12 +213,13 @@ void pa_fader_done(struct userdata *u)
 void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
 {
     pa_core         *core;
+    pa_fader        *fader;
     transition_time *transit;
     pa_sink         *sink;
-    pa_sink_input   *sinp, *origin;
+    pa_sink_input   *sinp;
     pa_cvolume_ramp_int  *ramp;
     mir_node        *device_node;
-    mir_node        *stream_node;
+    sink_mask       *sm;
     double           dB;
     pa_volume_t      newvol;
     pa_volume_t      oldvol;
@@ -97,77 +227,92 @@ void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
     uint32_t         i,j;
     int              class;
     bool             rampit;
-    bool             corked;
-    bool             muted;
     uint32_t         mask;
 
     pa_assert(u);
     pa_assert_se(u->fader);
     pa_assert_se((core = u->core));
 
-    transit = &u->fader->transit;
+    fader   = u->fader;
+    transit = &fader->transit;
     rampit  = transit->fade_in > 0 &&  transit->fade_out > 0;
 
     pa_log_debug("applying volume limits ...");
 
+    mir_volume_forget_limits(u);
+
+    fader->stats.passes++;
+    fader->stats.sinks = 0;
+    fader->stats.skipped = 0;
+    fader->stats.streams = 0;
+
     PA_IDXSET_FOREACH(sink, core->sinks, i) {
-        if ((device_node = pa_discover_find_node_by_ptr(u, sink))) {
-            pa_log_debug("   node '%s'", device_node->amname);
+        if ((device_node = pa_discover_find_node_by_sink(u, sink))) {
+            /* the mask is kept up to date by the stream events */
+            if (!(sm = pa_hashmap_get(fader->sinks,
+                                      PA_UINT32_TO_PTR(sink->index))))
+                continue;       /* no streams on the sink */
+
+            if (!sm->dirty && !fader->alldirty &&
+                !zone_is_dirty(u, device_node->zone))
+            {
+                fader->stats.skipped++;
+                continue;       /* nothing changed on the sink */
+            }
 
-            mask = 0;
+            sm->dirty = false;
+            mask = sm->mask;
 
-            PA_IDXSET_FOREACH(sinp, sink->inputs, j) {
-                origin = pa_utils_get_stream_origin(u, sinp);
-                stream_node = pa_discover_find_node_by_ptr(u, origin);
+            fader->stats.sinks++;
+            fader->stats.streams += pa_idxset_size(sink->inputs);
 
-                if (origin == NULL) {
-                    pa_log_debug("could not find origin for sink-input %d", sinp->index);
-                }
-                else if ((class = pa_utils_get_stream_class(sinp->proplist)) > 0) {
-
-                    corked = stream_node ? !stream_node->rset.grant : false;
-                    muted  = (sinp->muted  || pa_hashmap_get(sinp->volume_factor_items,
-                                                             "internal_mute"));
-                    if (origin != sinp) {
-                        muted |= (origin->muted || pa_hashmap_get(origin->volume_factor_items,
-                                                                  "internal_mute"));
-                    }
+            mir_trace(u, mir_trace_fader, mir_trace_fader_sink, stamp,
+                      sink->index, 0, 0, mask);
+
+            if (u->fader->offload && !rampit &&
+                !pa_sink_flat_volume_enabled(sink) &&
+                common_stream_limit(u, sink, device_node, mask, stamp, &dB))
+            {
+                /*
+                 * every stream has the same limit; let the sink apply it.
+                 * The sink is limited before the streams are relaxed, so
+                 * the switch never lets unattenuated audio through.
+                 */
+                pa_log_debug("     offloading attenuation %.2lf dB to sink %u",
+                             dB, sink->index);
 
-                    if (!corked && !muted)
-                        mask |= mir_volume_get_class_mask(class);
+                set_sink_limit(sink, sm, volume_from_dB(u->fader, dB));
 
-                    pa_log_debug("*** stream %u (origin %u) class: %d corked: %s muted: %s "
-                                 "(sinp:%s internal:%s)", sinp->index, origin->index,
-                                 class, corked?"yes":"no ",
-                           muted?"yes":"no", sinp->muted ? "yes":"no",
-                           pa_hashmap_get(sinp->volume_factor_items,"internal_mute")?"yes":"no");
+                PA_IDXSET_FOREACH(sinp, sink->inputs, j) {
+                    if (sinp->volume_factor.values[0] != PA_VOLUME_NORM)
+                        set_stream_volume_limit(u, sinp, PA_VOLUME_NORM, 0);
                 }
-                else
-                    pa_log_debug("*** steam %u (origin %u) class: %d", sinp->index, origin->index, class);
-            }
 
-            pa_log_debug("*** mask: 0x%x", mask);
+                flush_soft_volumes(u->fader);
+
+                continue;
+            }
 
             PA_IDXSET_FOREACH(sinp, sink->inputs, j) {
                 class = pa_utils_get_stream_class(sinp->proplist);
 
-                pa_log_debug("     stream %u (class %u)", sinp->index, class);
-
                 if (!class) {
-                    if (!(sinp->flags & PA_SINK_INPUT_START_RAMP_MUTED))
-                        pa_log_debug("        skipping");
+                    if (!(sinp->flags & PA_SINK_INPUT_START_RAMP_MUTED)) {
+                        mir_trace(u, mir_trace_fader, mir_trace_fader_skip,
+                                  stamp, sinp->index, 0, 0, 0);
+                    }
                     else {
                         sinp->flags &= ~((unsigned int)PA_SINK_INPUT_START_RAMP_MUTED);
                         time = transit->fade_in;
 
-                        pa_log_debug("        attenuation 0 dB "
-                                     "transition time %ld ms", time);
+                        mir_trace(u, mir_trace_fader, mir_trace_fader_stream,
+                                  stamp, sinp->index, 0, 0, time);
                         set_stream_volume_limit(u, sinp, PA_VOLUME_NORM, time);
                     }
                 }
                 else {
                     dB = mir_volume_apply_limits(u, device_node, mask, class, stamp);
-                    newvol = pa_sw_volume_from_dB(dB);
+                    newvol = volume_from_dB(u->fader, dB);
 
                     if (rampit) {
                         ramp   = &sinp->ramp;
@@ -185,17 +330,108 @@ void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
                         time = 0;
                     }
 
-                    if (oldvol == newvol)
-                        pa_log_debug("         attenuation %.2lf dB",dB);
-                    else {
-                        pa_log_debug("         attenuation %.2lf dB "
-                                     "transition time %ld ms", dB, time);
+                    mir_trace(u, mir_trace_fader, mir_trace_fader_stream,
+                              stamp, sinp->index, class, MIR_TRACE_DB(dB),
+                              time);
+
+                    if (oldvol != newvol)
                         set_stream_volume_limit(u, sinp, newvol, time);
-                    }
                 }
             } /* PA_IDXSET_FOREACH sinp */
+
+            flush_soft_volumes(u->fader);
+
+            /* the streams are limited again; now the sink can be relaxed */
+            if (sm->offload != PA_VOLUME_NORM) {
+                pa_log_debug("     streams diverged; taking back the "
+                             "attenuation from sink %u", sink->index);
+                set_sink_limit(sink, sm, PA_VOLUME_NORM);
+            }
         }
     } /* PA_IDXSET_FOREACH sink */
+
+    fader->dirtyzones = 0;
+    fader->alldirty = false;
+
+    pa_log_debug("volume limits applied on %u sink(s) with %u stream(s); "
+                 "%u sink(s) unchanged", fader->stats.sinks,
+                 fader->stats.streams, fader->stats.skipped);
+}
+
+void pa_fader_mark_device_dirty(struct userdata *u, mir_node *node)
+{
+    sink_mask *sm;
+
+    pa_assert(u);
+    pa_assert(u->fader);
+    pa_assert(node);
+
+    if (node->implement == mir_device && node->direction == mir_output &&
+        node->paidx != PA_IDXSET_INVALID)
+    {
+        if ((sm = pa_hashmap_get(u->fader->sinks,
+                                 PA_UINT32_TO_PTR(node->paidx))))
+            sm->dirty = true;
+    }
+}
+
+void pa_fader_mark_zone_dirty(struct userdata *u, const char *zone_name)
+{
+    mir_zone *zone;
+
+    pa_assert(u);
+    pa_assert(u->fader);
+
+    if (!zone_name || !(zone = pa_zoneset_get_zone_by_name(u, zone_name)) ||
+        zone->index >= sizeof(u->fader->dirtyzones) * 8)
+    {
+        u->fader->alldirty = true;
+    }
+    else
+        u->fader->dirtyzones |= ((uint32_t)1) << zone->index;
+}
+
+void pa_fader_mark_all_dirty(struct userdata *u)
+{
+    pa_assert(u);
+    pa_assert(u->fader);
+
+    u->fader->alldirty = true;
+}
+
+void pa_fader_sink_volume_changed(struct userdata *u, pa_sink *sink)
+{
+    pa_fader *fader;
+    sink_mask *sm;
+
+    pa_assert(u);
+    pa_assert(sink);
+    pa_assert_se((fader = u->fader));
+
+    if (!(sm = pa_hashmap_get(fader->sinks, PA_UINT32_TO_PTR(sink->index))))
+        return;
+
+    sm->dirty = true;
+
+    /*
+     * PA recomputes the soft volume of the sink on every volume change,
+     * dropping the offloaded limit. Put it back on the new soft volume.
+     */
+    if (sm->offload != PA_VOLUME_NORM &&
+        !pa_cvolume_equal(&sink->soft_volume, &sm->applied))
+    {
+        pa_log_debug("sink %u volume changed; reapplying the offloaded "
+                     "attenuation", sink->index);
+        set_sink_limit(sink, sm, sm->offload);
+    }
+}
+
+const pa_fader_stats *pa_fader_get_stats(struct userdata *u)
+{
+    pa_assert(u);
+    pa_assert(u->fader);
+
+    return &u->fader->stats;
 }
 
 void pa_fader_ramp_volume(struct userdata *u,
@@ -207,7 +443,6 @@ void pa_fader_ramp_volume(struct userdata *u,
     pa_volume_t           oldvol;
     pa_cvolume_ramp_int  *ramp;
     long                  time;
-    pa_cvolume_ramp       rampvol;
 
     pa_assert(u);
     pa_assert(u->fader);
@@ -218,15 +453,10 @@ void pa_fader_ramp_volume(struct userdata *u,
     ramp    = &sinp->ramp;
     oldvol  = ramp->ramps[0].target;
 
-    if (rampit && oldvol != newvol) {
+    /* schedule_ramp drops the ramp if the stream is heading there */
+    if (rampit) {
         time = (oldvol > newvol) ? transit->fade_out : transit->fade_in;
-
-        pa_cvolume_ramp_set(&rampvol,
-                            sinp->volume.channels,
-                            PA_VOLUME_RAMP_TYPE_LINEAR,
-                            time, newvol);
-
-        pa_sink_input_set_volume_ramp(sinp, &rampvol, true, false);
+        schedule_ramp(u->fader, sinp, newvol, time);
     }
 }
 
@@ -238,6 +468,7 @@ void pa_fader_set_volume(struct userdata *u,
     pa_volume_t oldvol;
     pa_cvolume_ramp_int *ramp;
     pa_cvolume_ramp  rampvol;
+    stream_ramp *r;
 
     pa_assert(u);
     pa_assert(sinp);
@@ -252,6 +483,13 @@ void pa_fader_set_volume(struct userdata *u,
                             0, newvol);
 
         pa_sink_input_set_volume_ramp(sinp, &rampvol, true, false);
+
+        if ((r = pa_hashmap_get(u->fader->ramps,
+                                PA_UINT32_TO_PTR(sinp->index))))
+        {
+            r->from = r->target = newvol;
+            r->length = 0;
+        }
     }
 }
 
@@ -269,19 +507,246 @@ pa_volume_t pa_fader_get_volume(struct userdata *u, pa_sink_input *sinp)
     return vol;
 }
 
+void pa_fader_update_stream(struct userdata *u, pa_sink_input *sinp)
+{
+    pa_core       *core;
+    mir_node      *node;
+    pa_sink_input *s;
+    uint32_t       idx;
+
+    pa_assert(u);
+    pa_assert(sinp);
+    pa_assert_se((core = u->core));
+
+    update_stream_mask(u, sinp);
+
+    /* the sink-inputs of a multiplexed stream inherit the state of it */
+    if ((node = pa_discover_find_node_by_sink_input(u, sinp)) && node->mux) {
+        PA_IDXSET_FOREACH(s, core->sink_inputs, idx) {
+            if (s != sinp && s->module &&
+                s->module->index == node->mux->module_index)
+            {
+                update_stream_mask(u, s);
+            }
+        }
+    }
+}
+
+void pa_fader_remove_stream(struct userdata *u, pa_sink_input *sinp)
+{
+    pa_fader   *fader;
+    stream_mask *st;
+
+    pa_assert(u);
+    pa_assert(sinp);
+    pa_assert_se((fader = u->fader));
+
+    if ((st = pa_hashmap_remove(fader->streams, PA_UINT32_TO_PTR(sinp->index)))) {
+        count_stream(u, st->sink, st->class, -1);
+        pa_xfree(st);
+    }
+
+    pa_xfree(pa_hashmap_remove(fader->ramps, PA_UINT32_TO_PTR(sinp->index)));
+}
+
+static bool zone_is_dirty(struct userdata *u, const char *zone_name)
+{
+    pa_fader *fader = u->fader;
+    mir_zone *zone;
+
+    if (!fader->dirtyzones)
+        return false;
+
+    if (!zone_name || !(zone = pa_zoneset_get_zone_by_name(u, zone_name)))
+        return false;
+
+    return zone->index < sizeof(fader->dirtyzones) * 8 &&
+           (fader->dirtyzones & (((uint32_t)1) << zone->index));
+}
+
+static void update_stream_mask(struct userdata *u, pa_sink_input *sinp)
+{
+    pa_fader      *fader;
+    pa_sink_input *origin;
+    mir_node      *stream_node;
+    stream_mask   *st;
+    uint32_t       sink;
+    int            class;
+    bool           corked;
+    bool           muted;
+
+    pa_assert(u);
+    pa_assert(sinp);
+    pa_assert_se((fader = u->fader));
+
+    sink  = sinp->sink ? sinp->sink->index : PA_IDXSET_INVALID;
+    class = 0;
+
+    if (!(origin = pa_utils_get_stream_origin(u, sinp)))
+        pa_log_debug("could not find origin for sink-input %d", sinp->index);
+    else if ((class = pa_utils_get_stream_class(sinp->proplist)) > 0) {
+        stream_node = pa_discover_find_node_by_sink_input(u, origin);
+
+        corked = stream_node ? !stream_node->rset.grant : false;
+        muted  = (sinp->muted  || pa_hashmap_get(sinp->volume_factor_items,
+                                                 "internal_mute"));
+        if (origin != sinp) {
+            muted |= (origin->muted || pa_hashmap_get(origin->volume_factor_items,
+                                                      "internal_mute"));
+        }
+
+        pa_log_debug("*** stream %u (origin %u) class: %d corked: %s "
+                     "muted: %s", sinp->index, origin->index, class,
+                     corked ? "yes":"no ", muted ? "yes":"no");
+
+        if (corked || muted)
+            class = -class;     /* on the sink but not counted in the mask */
+    }
+    else
+        class = 0;
+
+    if ((st = pa_hashmap_get(fader->streams, PA_UINT32_TO_PTR(sinp->index)))) {
+        if (st->sink == sink && st->class == class)
+            return;
+
+        count_stream(u, st->sink, st->class, -1);
+    }
+    else {
+        st = pa_xnew0(stream_mask, 1);
+        pa_hashmap_put(fader->streams, PA_UINT32_TO_PTR(sinp->index), st);
+    }
+
+    st->sink  = sink;
+    st->class = class;
+
+    count_stream(u, sink, class, 1);
+}
+
+static void count_stream(struct userdata *u, uint32_t sink, int class,int diff)
+{
+    pa_fader  *fader = u->fader;
+    sink_mask *sm;
+    pa_sink   *s;
+
+    if (sink == PA_IDXSET_INVALID)
+        return;
+
+    if (!(sm = pa_hashmap_get(fader->sinks, PA_UINT32_TO_PTR(sink)))) {
+        if (diff < 0)
+            return;
+
+        sm = pa_xnew0(sink_mask, 1);
+        sm->offload = PA_VOLUME_NORM;
+        pa_hashmap_put(fader->sinks, PA_UINT32_TO_PTR(sink), sm);
+    }
+
+    sm->nstream += diff;
+    sm->dirty = true;
+
+    if (class > 0 && class < mir_application_class_end) {
+        sm->count[class] += diff;
+
+        if (sm->count[class])
+            sm->mask |= mir_volume_get_class_mask(class);
+        else
+            sm->mask &= ~mir_volume_get_class_mask(class);
+    }
+
+    if (!sm->nstream) {
+        if (sm->offload != PA_VOLUME_NORM &&
+            (s = pa_idxset_get_by_index(u->core->sinks, sink)))
+            set_sink_limit(s, sm, PA_VOLUME_NORM);
+
+        pa_hashmap_remove(fader->sinks, PA_UINT32_TO_PTR(sink));
+        pa_xfree(sm);
+    }
+}
+
+static bool common_stream_limit(struct userdata *u,
+                                pa_sink         *sink,
+                                mir_node        *node,
+                                uint32_t         mask,
+                                uint32_t         stamp,
+                                double          *dB_ret)
+{
+    pa_sink_input *sinp;
+    uint32_t idx;
+    int class;
+    double dB;
+    bool first = true;
+
+    PA_IDXSET_FOREACH(sinp, sink->inputs, idx) {
+        /* unclassified streams must stay at their own volume */
+        if ((class = pa_utils_get_stream_class(sinp->proplist)) <= 0)
+            return false;
+
+        dB = mir_volume_apply_limits(u, node, mask, class, stamp);
+
+        if (!first && dB != *dB_ret)
+            return false;
+
+        *dB_ret = dB;
+        first = false;
+    }
+
+    return !first;
+}
+
+static void set_sink_limit(pa_sink *sink, sink_mask *sm, pa_volume_t vol)
+{
+    pa_cvolume cv;
+
+    if (vol == sm->offload && (vol == PA_VOLUME_NORM ||
+                               pa_cvolume_equal(&sink->soft_volume,
+                                                &sm->applied)))
+        return;
+
+    /* the sink might have changed its soft volume since we did */
+    if (sm->offload == PA_VOLUME_NORM ||
+        !pa_cvolume_equal(&sink->soft_volume, &sm->applied))
+    {
+        sm->base = sink->soft_volume;
+    }
+
+    if (vol == PA_VOLUME_NORM)
+        cv = sm->base;
+    else {
+        pa_cvolume_set(&cv, sm->base.channels, vol);
+        pa_sw_cvolume_multiply(&cv, &sm->base, &cv);
+    }
+
+    sm->offload = vol;
+    sm->applied = cv;
+
+    pa_sink_set_soft_volume(sink, &cv);
+}
+
 static void set_stream_volume_limit(struct userdata *u,
                                     pa_sink_input   *sinp,
                                     pa_volume_t      vol,
                                     long             ramp_time)
 {
     pa_sink *sink;
-    pa_cvolume_ramp rampvol;
+    stream_ramp *r;
 
     pa_assert(u);
     pa_assert(sinp);
     pa_assert_se((sink = sinp->sink));
 
     if (!ramp_time) {
+        /*
+         * the limit goes to the volume factor; keep the ramp record in
+         * step with the ramp of the stream so a later ramp starts from
+         * where the stream really is
+         */
+        if ((r = pa_hashmap_get(u->fader->ramps,
+                                PA_UINT32_TO_PTR(sinp->index))) &&
+            ramp_current_volume(r, pa_rtclock_now()) == r->target)
+        {
+            r->from = r->target = sinp->ramp.ramps[0].target;
+            r->length = 0;
+        }
+
         pa_cvolume_set(&sinp->volume_factor, sinp->volume.channels, vol);
 
         if (pa_sink_flat_volume_enabled(sink)) {
@@ -291,20 +756,200 @@ static void set_stream_volume_limit(struct userdata *u,
             pa_sw_cvolume_multiply(&sinp->soft_volume, &sinp->real_ratio,
                                    &sinp->volume_factor);
 
-            pa_asyncmsgq_send(sink->asyncmsgq, PA_MSGOBJECT(sinp),
-                              PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME,
-                              NULL, 0, NULL);
+            batch_soft_volume(u->fader, sinp);
         }
     }
-    else {
-        pa_cvolume_ramp_set(&rampvol,
-                            sinp->volume.channels,
-                            PA_VOLUME_RAMP_TYPE_LINEAR,
-                            ramp_time,
-                            vol);
+    else
+        schedule_ramp(u->fader, sinp, vol, ramp_time);
+}
 
-        pa_sink_input_set_volume_ramp(sinp, &rampvol, true, false);
+static stream_ramp *get_stream_ramp(pa_fader *fader, pa_sink_input *sinp)
+{
+    stream_ramp *r;
+
+    if (!(r = pa_hashmap_get(fader->ramps, PA_UINT32_TO_PTR(sinp->index)))) {
+        r = pa_xnew0(stream_ramp, 1);
+        r->from = r->target = sinp->ramp.ramps[0].target;
+        pa_hashmap_put(fader->ramps, PA_UINT32_TO_PTR(sinp->index), r);
+    }
+
+    return r;
+}
+
+static pa_volume_t ramp_current_volume(stream_ramp *r, pa_usec_t now)
+{
+    int64_t diff;
+
+    if (!r->length || now >= r->start + r->length)
+        return r->target;
+
+    diff = (int64_t)r->target - (int64_t)r->from;
+
+    return (pa_volume_t)((int64_t)r->from +
+                         diff * (int64_t)(now - r->start) / (int64_t)r->length);
+}
+
+static void schedule_ramp(pa_fader      *fader,
+                          pa_sink_input *sinp,
+                          pa_volume_t    vol,
+                          long           ramp_time)
+{
+    stream_ramp *r;
+    pa_cvolume_ramp rampvol;
+    pa_usec_t now;
+    pa_volume_t current;
+    uint64_t distance, span;
+
+    /*
+     * the in-flight ramp, or the last one if it has finished, ends at the
+     * requested volume already. A new record knows nothing about the
+     * stream's ramp (e.g. a muted start), so it never suppresses.
+     */
+    r = pa_hashmap_get(fader->ramps, PA_UINT32_TO_PTR(sinp->index));
+
+    if (r && vol == r->target) {
+        fader->rstats.suppressed++;
+        pa_log_debug("        ramp of stream %u is heading there already "
+                     "(%u ramps, %u merged, %u suppressed)", sinp->index,
+                     fader->rstats.started, fader->rstats.merged,
+                     fader->rstats.suppressed);
+        return;
+    }
+
+    r = get_stream_ramp(fader, sinp);
+    now = pa_rtclock_now();
+    current = ramp_current_volume(r, now);
+
+    if (current != r->target) {
+        /*
+         * continue from where the unfinished ramp is now, with the speed
+         * of the full fade, instead of starting a fade of full length
+         */
+        distance = vol > current ? vol - current : current - vol;
+        span = r->target > r->from ? r->target - r->from : r->from - r->target;
+
+        if (span < distance)
+            span = distance;
+
+        ramp_time = (long)((uint64_t)ramp_time * distance / span);
+
+        if (ramp_time < 1)
+            ramp_time = 1;
+
+        fader->rstats.merged++;
+    }
+
+    fader->rstats.started++;
+
+    r->from   = current;
+    r->target = vol;
+    r->start  = now;
+    r->length = (pa_usec_t)ramp_time * PA_USEC_PER_MSEC;
+
+    pa_cvolume_ramp_set(&rampvol,
+                        sinp->volume.channels,
+                        PA_VOLUME_RAMP_TYPE_LINEAR,
+                        ramp_time,
+                        vol);
+
+    pa_sink_input_set_volume_ramp(sinp, &rampvol, true, false);
+}
+
+static pa_volume_t volume_from_dB(pa_fader *fader, double dB)
+{
+    double step = (dB - DB_TABLE_MIN) * DB_TABLE_STEPS;
+    int idx;
+
+    /* range check before the conversion; NaN fails it as well */
+    if (step >= 0.0 && step < (double)DB_TABLE_SIZE) {
+        idx = (int)step;
+
+        if ((double)idx == step)
+            return fader->dBtable[idx];
     }
+
+    /* off the grid */
+    return pa_sw_volume_from_dB(dB);
+}
+
+static void batch_soft_volume(pa_fader *fader, pa_sink_input *sinp)
+{
+    volume_batch *batch = &fader->batch;
+    volume_batch_entry *entry;
+
+    pa_assert(sinp->sink);
+
+    if (batch->sink != sinp->sink) {
+        flush_soft_volumes(fader);
+        batch->sink = sinp->sink;
+    }
+
+    if (batch->nentry >= batch->maxentry) {
+        batch->maxentry += VOLUME_BATCH_BUCKET;
+        batch->entries = pa_xrealloc(batch->entries, sizeof(*entry) *
+                                     batch->maxentry);
+    }
+
+    entry = batch->entries + batch->nentry++;
+    entry->sinp = sinp;
+    entry->soft_volume = sinp->soft_volume;
+}
+
+static void flush_soft_volumes(pa_fader *fader)
+{
+    volume_batch *batch = &fader->batch;
+
+    if (batch->nentry > 0) {
+        pa_assert(batch->sink);
+
+        pa_log_debug("sending %zu soft volume(s) to sink %u",
+                     batch->nentry, batch->sink->index);
+
+        /*
+         * one synchronous round trip per sink; nothing of the batch, nor
+         * the inputs it points to, outlives the call
+         */
+        pa_assert_se(pa_asyncmsgq_send(batch->sink->asyncmsgq,
+                                       fader->batchobj, VOLUME_BATCH_MESSAGE,
+                                       batch, 0, NULL) == 0);
+    }
+
+    batch->sink = NULL;
+    batch->nentry = 0;
+}
+
+static int batch_process_msg(pa_msgobject *o,
+                             int           code,
+                             void         *data,
+                             int64_t       offset,
+                             pa_memchunk  *chunk)
+{
+    volume_batch *batch = data;
+    volume_batch_entry *entry;
+    pa_sink_input *sinp;
+    size_t i;
+
+    (void)o;
+    (void)offset;
+    (void)chunk;
+
+    /* runs in the IO thread of the sink */
+    pa_assert(code == VOLUME_BATCH_MESSAGE);
+    pa_assert(batch);
+
+    for (i = 0;  i < batch->nentry;  i++) {
+        entry = batch->entries + i;
+        sinp = entry->sinp;
+
+        if (!pa_cvolume_equal(&sinp->thread_info.soft_volume,
+                              &entry->soft_volume))
+        {
+            sinp->thread_info.soft_volume = entry->soft_volume;
+            pa_sink_input_request_rewind(sinp, 0, true, false, false);
+        }
+    }
+
+    return 0;
 }
 
 
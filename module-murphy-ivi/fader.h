@@ -25,12 +25,28 @@
 #include "userdata.h"
 #include "list.h"
 
+typedef struct {
+    uint32_t  passes;      /**< number of times the limits were applied */
+    uint32_t  sinks;       /**< sinks revisited in the last pass */
+    uint32_t  skipped;     /**< sinks left alone in the last pass */
+    uint32_t  streams;     /**< streams evaluated in the last pass */
+} pa_fader_stats;
 
-pa_fader *pa_fader_init(const char *, const char *);
+
+pa_fader *pa_fader_init(const char *, const char *, bool);
 void pa_fader_done(struct userdata *);
 
 void pa_fader_apply_volume_limits(struct userdata *, uint32_t);
 
+void pa_fader_mark_device_dirty(struct userdata *, mir_node *);
+void pa_fader_mark_zone_dirty(struct userdata *, const char *);
+void pa_fader_mark_all_dirty(struct userdata *);
+const pa_fader_stats *pa_fader_get_stats(struct userdata *);
+
+void pa_fader_update_stream(struct userdata *, pa_sink_input *);
+void pa_fader_remove_stream(struct userdata *, pa_sink_input *);
+void pa_fader_sink_volume_changed(struct userdata *, pa_sink *);
+
 void pa_fader_ramp_volume(struct userdata *, pa_sink_input *, pa_volume_t);
 void pa_fader_set_volume(struct userdata *, pa_sink_input *, pa_volume_t);
 pa_volume_t pa_fader_get_volume(struct userdata *, pa_sink_input *);
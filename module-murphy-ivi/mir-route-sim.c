@@ -0,0 +1,910 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * mir-route-sim -- replays a sequence of events against the policy core
+ *
+ * usage: mir-route-sim [-c config.lua] [-v] [-t subsystems] [event-file]
+ *        mir-route-sim -d trace-dump
+ *
+ * With -t the given subsystems (router,constrain,volume,fader or all)
+ * are traced and the trace is printed after the replay. -d decodes a
+ * trace dump saved from the module through the extension API.
+ *
+ * The event file has one event per line; '#' starts a comment:
+ *
+ *   card <name> <profile>                  new card with its active profile
+ *   sink <name> <type> [zone [card[:port]]]
+ *                                          new output device, optionally
+ *                                          made by a card profile
+ *   source <name> <type> [zone [card[:port]]]
+ *                                          new input device
+ *   sink-input <name> <class> [zone]       new playback stream
+ *   source-output <name> <class> [zone]    new recording stream
+ *   available <name> yes|no                device availability change
+ *   profile <card> <profile> [device ...]  profile change; the listed
+ *                                          devices of the card are kept,
+ *                                          the others go away
+ *   port <card> <port> yes|no              port availability change
+ *   grant <name> yes|no                    resource grant change
+ *   correction <dB>                        volume correction of the public
+ *                                          devices, like the speed
+ *                                          dependent one
+ *   connect <from> <to>                    explicit route
+ *   disconnect <from> <to>                 remove explicit route
+ *   remove <name>                          node goes away
+ *   move <stream> <device>                 stream moved by somebody else
+ *   preroute <name> <class> [zone]         routing of a playback stream
+ *                                          before it is made; tells
+ *                                          whether the others were left
+ *                                          alone
+ *   route                                  request full routing
+ *   hold                                   start of a hotplug storm
+ *   release                                the hotplug storm settled
+ *   tick                                   end of a mainloop iteration;
+ *                                          runs the deferred events
+ *
+ * Device types are the ones of the Lua configuration without the
+ * 'mir_' prefix (speakers, wired_headset, bluetooth_a2dp, ...); stream
+ * classes likewise (player, navigator, phone, ...).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <pulsecore/pulsecore-config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/proplist.h>
+#include <pulsecore/core.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/module.h>
+
+#include "userdata.h"
+#include "zone.h"
+#include "node.h"
+#include "router.h"
+#include "constrain.h"
+#include "volume.h"
+#include "fader.h"
+#include "utils.h"
+#include "trace.h"
+#include "scripting.h"
+#include "murphy-config.h"
+#include "sim-shim.h"
+
+#define MAX_ARGS  8
+
+typedef struct {
+    const char    *name;
+    mir_node_type  type;
+} type_def;
+
+typedef struct {
+    mir_connection *conn;
+    char           *from;
+    char           *to;
+} explicit_route;
+
+typedef struct {
+    char           *name;
+    uint32_t        index;
+    char           *profile;
+    pa_hashmap     *ports;    /**< port names the device nodes point to */
+    mir_dlist       nodes;    /**< device nodes linked by cardchain */
+} sim_card;
+
+static type_def types[] = {
+    { "radio"            , mir_radio             },
+    { "player"           , mir_player            },
+    { "navigator"        , mir_navigator         },
+    { "game"             , mir_game              },
+    { "browser"          , mir_browser           },
+    { "camera"           , mir_camera            },
+    { "phone"            , mir_phone             },
+    { "alert"            , mir_alert             },
+    { "event"            , mir_event             },
+    { "system"           , mir_system            },
+    { "null"             , mir_null              },
+    { "speakers"         , mir_speakers          },
+    { "front_speakers"   , mir_front_speakers    },
+    { "rear_speakers"    , mir_rear_speakers     },
+    { "microphone"       , mir_microphone        },
+    { "jack"             , mir_jack              },
+    { "hdmi"             , mir_hdmi              },
+    { "spdif"            , mir_spdif             },
+    { "wired_headset"    , mir_wired_headset     },
+    { "wired_headphone"  , mir_wired_headphone   },
+    { "usb_headset"      , mir_usb_headset       },
+    { "usb_headphone"    , mir_usb_headphone     },
+    { "bluetooth_sco"    , mir_bluetooth_sco     },
+    { "bluetooth_a2dp"   , mir_bluetooth_a2dp    },
+    { "bluetooth_carkit" , mir_bluetooth_carkit  },
+    { "bluetooth_source" , mir_bluetooth_source  },
+    { "bluetooth_sink"   , mir_bluetooth_sink    },
+    { "gateway_sink"     , mir_gateway_sink      },
+    { "gateway_source"   , mir_gateway_source    },
+    { NULL               , mir_node_type_unknown }
+};
+
+static pa_mainloop *mainloop;
+static pa_hashmap *nodes;
+static pa_hashmap *routes;
+static pa_hashmap *cards;
+static uint32_t    paidx;
+static uint32_t    cardidx;
+static uint32_t    npass;
+static pa_usec_t   total;
+static pa_usec_t   holdstart;
+static double      correction;
+static double     *correction_ptr = &correction;
+
+static struct userdata *sim_init(const char *, const char *);
+static void sim_done(struct userdata *);
+static int decode_dump(const char *);
+static void print_trace(struct userdata *);
+static int replay(struct userdata *, FILE *);
+static int execute(struct userdata *, int, char **, int);
+static mir_node *create_node(struct userdata *, mir_direction,
+                             mir_implement, int, char **);
+static void remove_node(struct userdata *, mir_node *);
+static sim_card *create_card(const char *, const char *);
+static void destroy_card(sim_card *);
+static void print_routing_tables(struct userdata *);
+static void run_pass(struct userdata *);
+static mir_node_type type_from_name(const char *);
+
+
+int main(int argc, char **argv)
+{
+    struct userdata *u;
+    const char *config = NULL;
+    const char *trace = NULL;
+    FILE *events;
+    bool verbose = false;
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "c:vt:d:h")) != -1) {
+        switch (opt) {
+        case 'c':   config = optarg;     break;
+        case 'v':   verbose = true;      break;
+        case 't':   trace = optarg;      break;
+        case 'd':   return decode_dump(optarg);
+        default:
+            fprintf(stderr, "usage: %s [-c config.lua] [-v] [-t subsystems] "
+                    "[event-file]\n       %s -d trace-dump\n",
+                    argv[0], argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    pa_log_set_level(verbose ? PA_LOG_DEBUG : PA_LOG_ERROR);
+
+    if (optind >= argc)
+        events = stdin;
+    else if (!(events = fopen(argv[optind], "r"))) {
+        fprintf(stderr, "can't open '%s': %s\n", argv[optind],
+                strerror(errno));
+        return 1;
+    }
+
+    sim_shim_set_output(stdout);
+
+    if (!(u = sim_init(config, trace)))
+        ret = 1;
+    else {
+        ret = replay(u, events);
+
+        printf("%u routing passes, %llu usec total, %llu usec/pass\n",
+               npass, (unsigned long long)total,
+               (unsigned long long)(npass ? total / npass : 0));
+        printf("%u routing requests, %u coalesced\n",
+               u->router->stats.requests, u->router->stats.saved);
+        printf("%u device events routed, %llu usec max, %llu usec average\n",
+               u->router->stats.events,
+               (unsigned long long)u->router->stats.maxlatency,
+               (unsigned long long)(u->router->stats.events ?
+                                    u->router->stats.totlatency /
+                                    u->router->stats.events : 0));
+        printf("%u device nodes registered in %u bulk(s)\n",
+               u->router->stats.held, u->router->stats.bulks);
+
+        print_routing_tables(u);
+
+        if (trace)
+            print_trace(u);
+
+        sim_done(u);
+    }
+
+    if (events != stdin)
+        fclose(events);
+
+    return ret;
+}
+
+
+static struct userdata *sim_init(const char *config, const char *trace)
+{
+    pa_core *core;
+    pa_module *module;
+    struct userdata *u;
+
+    if (!(mainloop = pa_mainloop_new()))
+        return NULL;
+
+    /* a core without modules; there is no audio device behind it */
+    if (!(core = pa_core_new(pa_mainloop_get_api(mainloop), false, 0))) {
+        pa_mainloop_free(mainloop);
+        return NULL;
+    }
+
+    module = pa_xnew0(pa_module, 1);
+    module->core = core;
+    module->name = pa_xstrdup("mir-route-sim");
+    module->proplist = pa_proplist_new();
+
+    u = pa_xnew0(struct userdata, 1);
+    u->core      = core;
+    u->module    = module;
+    u->trace     = pa_trace_init(u, trace);
+    u->zoneset   = pa_zoneset_init(u);
+    u->nodeset   = pa_nodeset_init(u);
+    u->router    = pa_router_init(u);
+    u->constrain = pa_constrain_init(u);
+    u->volume    = pa_mir_volume_init(u);
+#ifdef WITH_SCRIPTING
+    u->scripting = pa_scripting_init(u);
+#endif
+    u->config    = pa_mir_config_init(u);
+
+    module->userdata = u;
+
+    pa_mir_config_parse_file(u, config);
+
+    mir_volume_add_generic_limit(u, mir_volume_correction, &correction_ptr);
+
+    nodes = pa_hashmap_new(pa_idxset_string_hash_func,
+                           pa_idxset_string_compare_func);
+    routes = pa_hashmap_new(pa_idxset_string_hash_func,
+                            pa_idxset_string_compare_func);
+    cards = pa_hashmap_new(pa_idxset_string_hash_func,
+                           pa_idxset_string_compare_func);
+    cardidx = 1;
+
+    return u;
+}
+
+static void sim_done(struct userdata *u)
+{
+    pa_core *core = u->core;
+    pa_module *module = u->module;
+    explicit_route *rt;
+    mir_node *node;
+    sim_card *card;
+
+    while ((rt = pa_hashmap_steal_first(routes))) {
+        pa_xfree(rt->from);
+        pa_xfree(rt->to);
+        pa_xfree(rt);
+    }
+    pa_hashmap_free(routes);
+
+    while ((node = pa_hashmap_steal_first(nodes)))
+        mir_node_destroy(u, node);
+    pa_hashmap_free(nodes);
+
+    /* the nodes unlinked themselves from the card lists */
+    while ((card = pa_hashmap_steal_first(cards)))
+        destroy_card(card);
+    pa_hashmap_free(cards);
+
+    pa_constrain_done(u);
+    pa_router_done(u);
+    pa_mir_volume_done(u);
+    pa_mir_config_done(u);
+    pa_nodeset_done(u);
+    pa_zoneset_done(u);
+#ifdef WITH_SCRIPTING
+    pa_scripting_done(u);
+#endif
+    pa_trace_done(u);
+
+    pa_xfree(u);
+
+    pa_proplist_free(module->proplist);
+    pa_xfree(module->name);
+    pa_xfree(module);
+
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+
+static int decode_dump(const char *path)
+{
+    FILE *f;
+    char *buf;
+    long size;
+    int ret;
+
+    if (!(f = fopen(path, "r"))) {
+        fprintf(stderr, "can't open '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+
+    buf = pa_xmalloc(size > 0 ? size : 1);
+
+    if (size < 0 || fread(buf, 1, size, f) != (size_t)size)
+        ret = 1;
+    else if (mir_trace_decode(buf, size, stdout) < 0) {
+        fprintf(stderr, "'%s' is not a valid trace dump\n", path);
+        ret = 1;
+    }
+    else
+        ret = 0;
+
+    pa_xfree(buf);
+    fclose(f);
+
+    return ret;
+}
+
+static void print_trace(struct userdata *u)
+{
+    void *buf;
+    size_t size;
+
+    buf = pa_trace_dump(u, &size);
+    mir_trace_decode(buf, size, stdout);
+    pa_xfree(buf);
+}
+
+
+static int replay(struct userdata *u, FILE *events)
+{
+    char line[1024];
+    char *argv[MAX_ARGS];
+    char *p, *save;
+    int argc;
+    int lineno;
+
+    for (lineno = 1;  fgets(line, sizeof(line), events);  lineno++) {
+        if ((p = strchr(line, '#')))
+            *p = 0;
+
+        for (argc = 0, p = strtok_r(line, " \t\n", &save);
+             p && argc < MAX_ARGS;
+             p = strtok_r(NULL, " \t\n", &save))
+        {
+            argv[argc++] = p;
+        }
+
+        if (argc > 0 && execute(u, argc, argv, lineno) < 0)
+            return 1;
+    }
+
+    /* whatever is left would be done in the next mainloop iteration */
+    run_pass(u);
+
+    return 0;
+}
+
+static int execute(struct userdata *u, int argc, char **argv, int lineno)
+{
+    const char *cmd = argv[0];
+    mir_node *node, *from, *to, *n;
+    mir_node data;
+    explicit_route *rt;
+    sim_card *card;
+    char key[512];
+    pa_usec_t start;
+    bool yes, keep, route;
+    uint32_t shortcuts;
+    int i;
+
+    printf("%d: %s", lineno, cmd);
+    for (i = 1;  i < argc;  i++)
+        printf(" %s", argv[i]);
+    printf("\n");
+
+    if (!strcmp(cmd, "tick")) {
+        run_pass(u);
+        return 0;
+    }
+
+    if (!strcmp(cmd, "route")) {
+        mir_router_make_routing(u);
+        return 0;
+    }
+
+    if (!strcmp(cmd, "hold")) {
+        if (!u->router->trans.hold)
+            holdstart = pa_rtclock_now();
+        mir_router_hold_routing(u);
+        return 0;
+    }
+
+    if (!strcmp(cmd, "release")) {
+        if (!u->router->trans.hold)
+            goto invalid;
+        if (mir_router_release_routing(u))
+            mir_router_note_device_event(u, holdstart);
+        return 0;
+    }
+
+    if (!strcmp(cmd, "card")) {
+        if (argc < 3)
+            goto missing_args;
+        if (pa_hashmap_get(cards, argv[1]))
+            goto invalid;
+
+        card = create_card(argv[1], argv[2]);
+        pa_hashmap_put(cards, card->name, card);
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "sink") || !strcmp(cmd, "source")) {
+        if (argc < 3)
+            goto missing_args;
+
+        node = create_node(u, cmd[1] == 'i' ? mir_output : mir_input,
+                           mir_device, argc, argv);
+
+        if (!node)
+            goto invalid;
+
+        mir_router_mark_node_dirty(u, node);
+        mir_router_make_incremental_routing(u);
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "sink-input") || !strcmp(cmd, "source-output")) {
+        if (argc < 3)
+            goto missing_args;
+
+        node = create_node(u, cmd[1] == 'i' ? mir_input : mir_output,
+                           mir_stream, argc, argv);
+
+        if (!node)
+            goto invalid;
+
+        mir_router_make_incremental_routing(u);
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "remove")) {
+        if (argc < 2)
+            goto missing_args;
+        if (!(node = pa_hashmap_remove(nodes, argv[1])))
+            goto unknown_node;
+
+        remove_node(u, node);
+        mir_router_make_incremental_routing(u);
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "move")) {
+        if (argc < 3)
+            goto missing_args;
+        if (!(node = pa_hashmap_get(nodes, argv[1])) ||
+            !(to   = pa_hashmap_get(nodes, argv[2])))
+            goto unknown_node;
+        if (node->implement != mir_stream || to->implement != mir_device)
+            goto invalid;
+
+        mir_router_stream_moved(u, node, to->paidx);
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "preroute")) {
+        if (argc < 3)
+            goto missing_args;
+
+        memset(&data, 0, sizeof(data));
+        data.direction = mir_input;
+        data.implement = mir_stream;
+        data.channels  = 2;
+        data.type      = type_from_name(argv[2]);
+        data.zone      = argc > 3 ? argv[3] : PA_ZONE_NAME_DEFAULT;
+        data.visible   = true;
+        data.available = true;
+        data.amname    = argv[1];
+        data.amid      = AM_ID_INVALID;
+        data.paidx     = PA_IDXSET_INVALID;
+
+        if (data.type < mir_application_class_begin ||
+            data.type >= mir_application_class_end)
+            goto invalid;
+
+        shortcuts = u->router->stats.shortcuts;
+        mir_router_make_prerouting(u, &data);
+
+        printf("   pre-routed '%s' %s\n", argv[1],
+               u->router->stats.shortcuts != shortcuts ?
+               "by the shortcut" : "with a full pass");
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "profile")) {
+        if (argc < 3)
+            goto missing_args;
+        if (!(card = pa_hashmap_get(cards, argv[1])))
+            goto unknown_card;
+
+        start = pa_rtclock_now();
+        route = false;
+
+        pa_xfree(card->profile);
+        card->profile = pa_xstrdup(argv[2]);
+
+        /*
+         * like the alsa path of the discover: the devices of the new
+         * profile are made again, the rest of the card's devices are gone
+         */
+        MIR_DLIST_FOR_EACH_SAFE(mir_node,cardchain, node,n, &card->nodes) {
+            for (keep = false, i = 3;  i < argc && !keep;  i++)
+                keep = !strcmp(argv[i], node->amname);
+
+            if (keep) {
+                pa_xfree(node->pacard.profile);
+                node->pacard.profile = pa_xstrdup(card->profile);
+            }
+            else {
+                pa_hashmap_remove(nodes, node->amname);
+                remove_node(u, node);
+                route = true;
+            }
+        }
+
+        if (route) {
+            mir_router_note_device_event(u, start);
+            mir_router_make_incremental_routing(u);
+        }
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "port")) {
+        if (argc < 4)
+            goto missing_args;
+        if (!(card = pa_hashmap_get(cards, argv[1])))
+            goto unknown_card;
+
+        start = pa_rtclock_now();
+        route = false;
+        yes = !strcmp(argv[3], "yes");
+
+        /* only the nodes of the port's own card are looked at */
+        MIR_DLIST_FOR_EACH(mir_node,cardchain, node, &card->nodes) {
+            if (node->paport && !strcmp(node->paport, argv[2]) &&
+                node->available != yes)
+            {
+                node->available = yes;
+                mir_router_mark_node_dirty(u, node);
+                route = true;
+            }
+        }
+
+        if (route) {
+            mir_router_note_device_event(u, start);
+            mir_router_make_incremental_routing(u);
+        }
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "available") || !strcmp(cmd, "grant")) {
+        if (argc < 3)
+            goto missing_args;
+        if (!(node = pa_hashmap_get(nodes, argv[1])))
+            goto unknown_node;
+
+        yes = !strcmp(argv[2], "yes");
+
+        if (cmd[0] == 'a') {
+            if (node->available != yes) {
+                node->available = yes;
+                mir_router_mark_node_dirty(u, node);
+                mir_router_note_device_event(u, pa_rtclock_now());
+                mir_router_make_incremental_routing(u);
+            }
+        }
+        else {
+            node->rset.grant = yes;
+            pa_fader_apply_volume_limits(u, pa_utils_get_stamp());
+        }
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "correction")) {
+        if (argc < 2)
+            goto missing_args;
+
+        correction = strtod(argv[1], NULL);
+        pa_fader_apply_volume_limits(u, pa_utils_get_stamp());
+
+        return 0;
+    }
+
+    if (!strcmp(cmd, "connect") || !strcmp(cmd, "disconnect")) {
+        if (argc < 3)
+            goto missing_args;
+        if (!(from = pa_hashmap_get(nodes, argv[1])) ||
+            !(to   = pa_hashmap_get(nodes, argv[2])))
+            goto unknown_node;
+
+        snprintf(key, sizeof(key), "%s=>%s", argv[1], argv[2]);
+
+        if (!strcmp(cmd, "connect")) {
+            if (pa_hashmap_get(routes, key))
+                return 0;
+
+            rt = pa_xnew0(explicit_route, 1);
+            rt->from = pa_xstrdup(argv[1]);
+            rt->to   = pa_xstrdup(argv[2]);
+            rt->conn = mir_router_add_explicit_route(u, AM_ID_INVALID,
+                                                     from, to);
+            pa_hashmap_put(routes, pa_xstrdup(key), rt);
+        }
+        else {
+            if (!(rt = pa_hashmap_remove(routes, key)))
+                return 0;
+
+            mir_router_remove_explicit_route(u, rt->conn);
+            pa_xfree(rt->from);
+            pa_xfree(rt->to);
+            pa_xfree(rt);
+        }
+
+        return 0;
+    }
+
+    fprintf(stderr, "line %d: unknown event '%s'\n", lineno, cmd);
+    return -1;
+
+ missing_args:
+    fprintf(stderr, "line %d: missing arguments for '%s'\n", lineno, cmd);
+    return -1;
+
+ unknown_node:
+    fprintf(stderr, "line %d: unknown node\n", lineno);
+    return -1;
+
+ unknown_card:
+    fprintf(stderr, "line %d: unknown card\n", lineno);
+    return -1;
+
+ invalid:
+    fprintf(stderr, "line %d: invalid '%s' event\n", lineno, cmd);
+    return -1;
+}
+
+static mir_node *create_node(struct userdata *u,
+                             mir_direction    direction,
+                             mir_implement    implement,
+                             int              argc,
+                             char           **argv)
+{
+    const char *name = argv[1];
+    const char *zone = argc > 3 ? argv[3] : PA_ZONE_NAME_DEFAULT;
+    sim_card *card = NULL;
+    char *port = NULL;
+    mir_node_type type;
+    mir_node data, *node;
+    char key[256];
+    char cardname[256];
+    char *colon;
+
+    if (pa_hashmap_get(nodes, name))
+        return NULL;
+
+    if (argc > 4) {
+        if (implement != mir_device)
+            return NULL;
+
+        snprintf(cardname, sizeof(cardname), "%s", argv[4]);
+
+        if ((colon = strchr(cardname, ':')))
+            *colon++ = 0;
+
+        if (!(card = pa_hashmap_get(cards, cardname)))
+            return NULL;
+
+        if (colon && *colon && !(port = pa_hashmap_get(card->ports, colon))) {
+            port = pa_xstrdup(colon);
+            pa_hashmap_put(card->ports, port, port);
+        }
+    }
+
+    type = type_from_name(argv[2]);
+
+    if (implement == mir_device) {
+        if (type < mir_device_class_begin || type >= mir_device_class_end)
+            return NULL;
+    }
+    else {
+        if (type < mir_application_class_begin ||
+            type >= mir_application_class_end)
+            return NULL;
+    }
+
+    snprintf(key, sizeof(key), "%s@sim", name);
+
+    memset(&data, 0, sizeof(data));
+    data.key       = key;
+    data.direction = direction;
+    data.implement = implement;
+    data.channels  = 2;
+    data.type      = type;
+    data.zone      = (char *)zone;
+    data.visible   = true;
+    data.available = true;
+    data.amname    = (char *)name;
+    data.amdescr   = (char *)name;
+    data.amid      = AM_ID_INVALID;
+    data.paname    = (char *)name;
+    data.paidx     = paidx++;
+
+    if (implement == mir_device) {
+        data.location = mir_internal;
+        data.privacy  = (type == mir_speakers || type == mir_front_speakers ||
+                         type == mir_rear_speakers) ? mir_public : mir_private;
+    }
+
+    if (card) {
+        data.pacard.index   = card->index;
+        data.pacard.profile = card->profile;
+        data.paport         = port;
+    }
+
+    node = mir_node_create(u, &data);
+    pa_hashmap_put(nodes, (void *)node->amname, node);
+
+    if (card)
+        MIR_DLIST_APPEND(mir_node,cardchain, node, &card->nodes);
+
+    return node;
+}
+
+static void remove_node(struct userdata *u, mir_node *node)
+{
+    mir_node *to;
+
+    if (node->implement == mir_stream) {
+        if ((to = mir_node_find_by_index(u, node->rtarget)))
+            mir_router_mark_node_dirty(u, to);
+    }
+    else {
+        node->available = false;
+        mir_router_mark_node_dirty(u, node);
+    }
+
+    mir_node_destroy(u, node);
+}
+
+static sim_card *create_card(const char *name, const char *profile)
+{
+    sim_card *card = pa_xnew0(sim_card, 1);
+
+    card->name    = pa_xstrdup(name);
+    card->index   = cardidx++;
+    card->profile = pa_xstrdup(profile);
+    card->ports   = pa_hashmap_new_full(pa_idxset_string_hash_func,
+                                        pa_idxset_string_compare_func,
+                                        pa_xfree, NULL);
+    MIR_DLIST_INIT(card->nodes);
+
+    return card;
+}
+
+static void destroy_card(sim_card *card)
+{
+    pa_hashmap_free(card->ports);
+    pa_xfree(card->profile);
+    pa_xfree(card->name);
+    pa_xfree(card);
+}
+
+static void print_routing_tables(struct userdata *u)
+{
+    pa_proplist *pl = u->module->proplist;
+    const char *key;
+    void *state = NULL;
+
+    while ((key = pa_proplist_iterate(pl, &state))) {
+        if (!strncmp(key, PA_PROP_ROUTING_TABLE ".",
+                     sizeof(PA_PROP_ROUTING_TABLE)))
+            printf("%s: %s\n", key, pa_proplist_gets(pl, key));
+    }
+}
+
+static void run_pass(struct userdata *u)
+{
+    pa_router *router = u->router;
+    pa_usec_t start, elapsed;
+    uint32_t passes;
+
+    sim_shim_reset_stats();
+
+    passes = router->stats.passes;
+    start = pa_rtclock_now();
+
+    /*
+     * dispatch the pending deferred events, the routing request and the
+     * routing table properties included, the way the daemon would at the
+     * end of the iteration
+     */
+    if (pa_mainloop_iterate(mainloop, 0, NULL) < 0)
+        fprintf(stderr, "mainloop iteration failed\n");
+
+    elapsed = pa_rtclock_now() - start;
+
+    if (router->stats.passes != passes) {
+        npass++;
+        total += elapsed;
+
+        printf("   pass %u: %u streams touched, %u kept, %u links, "
+               "%u unchanged, %llu usec\n", router->stats.passes,
+               router->stats.touched, router->stats.kept,
+               sim_shim_get_stats()->links, router->stats.unchanged,
+               (unsigned long long)elapsed);
+    }
+}
+
+static mir_node_type type_from_name(const char *name)
+{
+    type_def *t;
+
+    if (!strncmp(name, "mir_", 4))
+        name += 4;
+
+    for (t = types;  t->name;  t++) {
+        if (!strcmp(name, t->name))
+            return t->type;
+    }
+
+    return mir_node_type_unknown;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
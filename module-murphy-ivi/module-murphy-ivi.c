@@ -64,6 +64,7 @@
 #include "murphyif.h"
 #include "resource.h"
 #include "classify.h"
+#include "trace.h"
 
 #ifndef DEFAULT_CONFIG_DIR
 #define DEFAULT_CONFIG_DIR "/etc/pulse"
@@ -87,6 +88,7 @@ PA_MODULE_USAGE(
     "fade_out=<stream fade-out time in msec> "
     "fade_in=<stream fade-in time in msec> "
     "enable_multiplex=<boolean for disabling combine creation> "
+    "volume_offload=<boolean for moving common stream limits to the sink> "
 #ifdef WITH_DOMCTL
     "murphy_domain_controller=<address of Murphy's domain controller service> "
 #endif
@@ -94,6 +96,8 @@ PA_MODULE_USAGE(
     "murphy_resources=<address of Murphy's native resource service> "
 #endif
     "null_sink_name=<name of the null sink> "
+    "trace=<comma separated list of the subsystems to trace> "
+    "hotplug_settle=<msec of quiet after device appearances before routing> "
 );
 
 static const char* const valid_modargs[] = {
@@ -102,6 +106,7 @@ static const char* const valid_modargs[] = {
     "fade_out",
     "fade_in",
     "enable_multiplex",
+    "volume_offload",
 #ifdef WITH_DOMCTL
     "murphy_domain_controller",
 #endif
@@ -109,6 +114,8 @@ static const char* const valid_modargs[] = {
     "murphy_resources",
 #endif
     "null_sink_name",
+    "trace",
+    "hotplug_settle",
     NULL
 };
 
@@ -126,9 +133,12 @@ int pa__init(pa_module *m) {
     const char      *resaddr;
 #endif
     const char      *nsnam;
+    const char      *trace;
+    const char      *settle;
     const char      *cfgpath;
     char             buf[4096];
     bool             enable_multiplex = true;
+    bool             volume_offload = false;
 
 
     pa_assert(m);
@@ -146,6 +156,9 @@ int pa__init(pa_module *m) {
     if (pa_modargs_get_value_boolean(ma, "enable_multiplex", &enable_multiplex) < 0)
         enable_multiplex = true;
 
+    if (pa_modargs_get_value_boolean(ma, "volume_offload", &volume_offload) < 0)
+        volume_offload = false;
+
 #ifdef WITH_DOMCTL
     ctladdr  = pa_modargs_get_value(ma, "murphy_domain_controller", NULL);
 #endif
@@ -154,20 +167,23 @@ int pa__init(pa_module *m) {
 #endif
 
     nsnam    = pa_modargs_get_value(ma, "null_sink_name", NULL);
+    trace    = pa_modargs_get_value(ma, "trace", NULL);
+    settle   = pa_modargs_get_value(ma, "hotplug_settle", NULL);
 
     u = pa_xnew0(struct userdata, 1);
     u->core      = m->core;
     u->module    = m;
+    u->trace     = pa_trace_init(u, trace);
     u->nullsink  = pa_utils_create_null_sink(u, nsnam);
     u->zoneset   = pa_zoneset_init(u);
     u->nodeset   = pa_nodeset_init(u);
-    u->discover  = pa_discover_init(u);
+    u->discover  = pa_discover_init(u, settle);
     u->tracker   = pa_tracker_init(u);
     u->router    = pa_router_init(u);
     u->constrain = pa_constrain_init(u);
     u->multiplex = pa_multiplex_init();
     u->loopback  = pa_loopback_init();
-    u->fader     = pa_fader_init(fadeout, fadein);
+    u->fader     = pa_fader_init(fadeout, fadein, volume_offload);
     u->volume    = pa_mir_volume_init(u);
 #ifdef WITH_SCRIPTING
     u->scripting = pa_scripting_init(u);
@@ -249,6 +265,7 @@ void pa__done(pa_module *m) {
         pa_multiplex_done(u->multiplex, u->core);
 
         pa_extapi_done(u);
+        pa_trace_done(u);
 
         if (u->protocol) {
             pa_native_protocol_remove_ext(u->protocol, m);
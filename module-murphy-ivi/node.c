@@ -318,6 +318,7 @@ mir_node *mir_node_create(struct userdata *u, mir_node *data)
     pa_idxset_put(ns->nodes, node, &node->index);
 
     node->key        = pa_xstrdup(data->key);
+    node->ikey       = data->ikey;
     node->direction  = data->direction;
     node->implement  = data->implement;
     node->channels   = data->channels;
@@ -335,6 +336,8 @@ mir_node *mir_node_create(struct userdata *u, mir_node *data)
     node->mux        = data->mux;
     node->loop       = data->loop;
     node->stamp      = data->stamp;
+    node->rtarget    = PA_IDXSET_INVALID;
+    node->rtlink     = PA_IDXSET_INVALID;
     node->rset.id    = data->rset.id ? pa_xstrdup(data->rset.id) : NULL;
     node->rset.grant = data->rset.grant;
 #ifdef WITH_SCRIPTING
@@ -342,7 +345,10 @@ mir_node *mir_node_create(struct userdata *u, mir_node *data)
 #endif
     MIR_DLIST_INIT(node->rtentries);
     MIR_DLIST_INIT(node->rtprilist);
+    MIR_DLIST_INIT(node->connfrom);
+    MIR_DLIST_INIT(node->connto);
     MIR_DLIST_INIT(node->constrains);
+    MIR_DLIST_INIT(node->cardchain);
 
     if (node->implement == mir_device) {
         node->pacard.index = data->pacard.index;
@@ -381,6 +387,7 @@ void mir_node_destroy(struct userdata *u, mir_node *node)
         pa_scripting_node_destroy(u, node);
 #endif
         pa_idxset_remove_by_index(ns->nodes, node->index);
+        MIR_DLIST_UNLINK(mir_node, cardchain, node);
 
         pa_xfree(node->key);
         pa_xfree(node->zone);
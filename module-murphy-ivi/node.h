@@ -69,6 +69,8 @@ struct pa_node_rset {
 struct mir_node {
     uint32_t       index;     /**< index into nodeset->idxset */
     char          *key;       /**< hash key for discover lookups */
+    uint64_t       ikey;      /**< interned (name,port,profile) key of
+                                   card devices or 0 */
     mir_direction  direction; /**< mir_input | mir_output */
     mir_implement  implement; /**< mir_device | mir_stream */
     uint32_t       channels;  /**< number of channels (eg. 1=mono, 2=stereo) */
@@ -87,11 +89,21 @@ struct mir_node {
     uint32_t       paidx;     /**< sink|source|sink_input|source_output index*/
     pa_node_card   pacard;    /**< pulse card related data, if any  */
     const char    *paport;    /**< sink or source port if applies */
+    mir_dlist      cardchain; /**< in card device nodes: link of the nodes
+                                   of the same card (head is in pa_discover)*/
     pa_muxnode    *mux;       /**< for multiplexable input streams only */
     pa_loopnode   *loop;      /**< for looped back sources only */
     mir_dlist      rtentries; /**< in device nodes: listhead of nodchain */
     mir_dlist      rtprilist; /**< in stream nodes: priority link (head is in
                                                                    pa_router)*/
+    uint32_t       rtarget;   /**< in stream nodes: index of the node where
+                                   the default route currently leads to */
+    uint32_t       rtlink;    /**< in stream nodes: index of the node the
+                                   default route was last set up to */
+    mir_dlist      connfrom;  /**< listhead of the explicit routes (fromchain)
+                                   starting from this node */
+    mir_dlist      connto;    /**< listhead of the explicit routes (tochain)
+                                   leading to this node */
     mir_dlist      constrains;/**< listhead of constrains */
     mir_vlim       vlim;      /**< volume limit */
     pa_node_rset   rset;      /**< resource set info if applies */
@@ -34,6 +34,7 @@
 
 #include "resource.h"
 #include "node.h"
+#include "fader.h"
 #include "stream-state.h"
 
 
@@ -960,6 +961,11 @@ static void enforce_policy(struct userdata *u,
     pa_assert_se((policy = rset->policy[type]));
 
     grant = rset->grant[type];
+
+    /* the limits of the zone depend on which streams hold the resources */
+    if (node->rset.grant != grant)
+        pa_fader_mark_zone_dirty(u, node->zone);
+
     node->rset.grant = grant;
 
 
@@ -28,6 +28,7 @@
 
 #include <pulse/proplist.h>
 #include <pulsecore/module.h>
+#include <pulsecore/core-rtclock.h>
 
 #include "router.h"
 #include "zone.h"
@@ -36,6 +37,8 @@
 #include "constrain.h"
 #include "volume.h"
 #include "fader.h"
+#include "multiplex.h"
+#include "trace.h"
 #include "utils.h"
 #include "classify.h"
 
@@ -43,13 +46,55 @@ static void rtgroup_destroy(struct userdata *, mir_rtgroup *);
 static int rtgroup_print(mir_rtgroup *, char *, int);
 static void rtgroup_update_module_property(struct userdata *, mir_direction,
                                            mir_rtgroup *);
+static void rtgroup_mark_property_dirty(struct userdata *, mir_rtgroup *);
+static void property_event_cb(pa_mainloop_api *, pa_defer_event *, void *);
+
+static mir_rtgroup_key_t rtgroup_builtin_key(mir_rtgroup_compare_t);
+static bool rtentry_before(struct userdata *, mir_rtgroup *,
+                           mir_rtentry *, mir_rtentry *);
+static size_t rtgroup_find_position(struct userdata *, mir_rtgroup *,
+                                    mir_rtentry *);
+static size_t rtgroup_index_of(mir_rtgroup *, mir_rtentry *);
+static bool rtentry_routable(mir_rtentry *);
+static void rtgroup_set_routable(mir_rtgroup *, size_t, bool);
+static void rtgroup_update_routable(mir_rtgroup *);
+static void rtgroup_insert_routable(mir_rtgroup *, size_t, bool);
+static void rtgroup_remove_routable(mir_rtgroup *, size_t);
+static size_t rtgroup_last_routable(mir_rtgroup *, size_t);
+static void update_node_routable(mir_node *);
+
+static mir_rtgroup **classmap_entry(pa_router *, uint32_t, mir_direction,
+                                    mir_node_type);
+
+static void register_node(struct userdata *, mir_node *);
+static uint32_t register_held_nodes(struct userdata *);
+static void add_to_nodlist(struct userdata *, mir_node *);
 
 static void add_rtentry(struct userdata *, mir_direction, mir_rtgroup *,
                         mir_node *);
+static void add_rtentries(struct userdata *, mir_direction, mir_rtgroup *,
+                          mir_node **, uint32_t);
 static void remove_rtentry(struct userdata *, mir_rtentry *);
 
+static void mark_rtgroup_dirty(struct userdata *, mir_direction,
+                               mir_rtgroup *);
+static void mark_device_dirty(struct userdata *, mir_node *);
+static void mark_node_dirty(struct userdata *, mir_node *);
+static bool stream_is_dirty(struct userdata *, mir_node *);
+static void clear_dirty(struct userdata *);
+
+static void request_routing(struct userdata *);
+static void routing_event_cb(pa_mainloop_api *, pa_defer_event *, void *);
+static void make_routing(struct userdata *);
 static void make_explicit_routes(struct userdata *, uint32_t);
+static void connection_unlink_nodes(mir_connection *);
+static void invalidate_connections(mir_node *);
 static mir_node *find_default_route(struct userdata *, mir_node *, uint32_t);
+static mir_node *keep_default_route(struct userdata *, mir_node *, uint32_t);
+static void plan_add(pa_router *, mir_node *, mir_node *);
+static void apply_plan(struct userdata *, uint32_t);
+static void forget_links(struct userdata *, mir_node *);
+static bool preroute_is_local(struct userdata *, mir_node *, int);
 static void implement_preroute(struct userdata *, mir_node *, mir_node *,
                                uint32_t);
 static void implement_default_route(struct userdata *, mir_node *, mir_node *,
@@ -57,6 +102,12 @@ static void implement_default_route(struct userdata *, mir_node *, mir_node *,
 
 static int uint32_cmp(uint32_t, uint32_t);
 
+#define CLASS_BIT(c)  (((uint32_t)1) << (c))
+
+#define RTGROUP_INDEX_BUCKET  32
+#define PLAN_BUCKET           16
+#define ROUTABLE_WORDS(n)     (((n) + 31) / 32)
+
 static int node_priority(struct userdata *, mir_node *);
 
 static int volume_class(mir_node *);
@@ -67,15 +118,28 @@ pa_router *pa_router_init(struct userdata *u)
 {
     size_t num_classes = mir_application_class_end;
     pa_router *router = pa_xnew0(pa_router, 1);
+    pa_mainloop_api *mainloop = u->core->mainloop;
 
     router->rtgroups.input  = pa_hashmap_new(pa_idxset_string_hash_func,
                                             pa_idxset_string_compare_func);
     router->rtgroups.output = pa_hashmap_new(pa_idxset_string_hash_func,
                                              pa_idxset_string_compare_func);
 
+    pa_assert(num_classes <= sizeof(uint32_t) * 8);
+
     router->maplen = num_classes;
 
     router->priormap = pa_xnew0(int, num_classes);
+    router->classmap = pa_xnew0(mir_rtgroup *, MRP_ZONE_MAX * 2 * num_classes);
+
+    router->trans.defer = mainloop->defer_new(mainloop, routing_event_cb, u);
+    mainloop->defer_enable(router->trans.defer, 0);
+
+    router->trans.held = pa_idxset_new(pa_idxset_trivial_hash_func,
+                                       pa_idxset_trivial_compare_func);
+
+    router->propdefer = mainloop->defer_new(mainloop, property_event_cb, u);
+    mainloop->defer_enable(router->propdefer, 0);
 
     MIR_DLIST_INIT(router->nodlist);
     MIR_DLIST_INIT(router->connlist);
@@ -90,8 +154,6 @@ void pa_router_done(struct userdata *u)
     mir_node       *e,*n;
     void           *state;
     mir_rtgroup    *rtg;
-    mir_rtgroup   **map;
-    int             i;
 
     if (u && (router = u->router)) {
         MIR_DLIST_FOR_EACH_SAFE(mir_node, rtprilist, e,n, &router->nodlist) {
@@ -100,6 +162,7 @@ void pa_router_done(struct userdata *u)
 
         MIR_DLIST_FOR_EACH_SAFE(mir_connection,link, conn,c,&router->connlist){
             MIR_DLIST_UNLINK(mir_connection, link, conn);
+            connection_unlink_nodes(conn);
             pa_xfree(conn);
         }
 
@@ -114,14 +177,17 @@ void pa_router_done(struct userdata *u)
         pa_hashmap_free(router->rtgroups.input);
         pa_hashmap_free(router->rtgroups.output);
 
-        for (i = 0;  i < MRP_ZONE_MAX;  i++) {
-            if ((map = router->classmap.input[i]))
-                pa_xfree(map);
+        if (router->trans.defer)
+            u->core->mainloop->defer_free(router->trans.defer);
 
-            if ((map = router->classmap.output[i]))
-                pa_xfree(map);
-        }
+        if (router->trans.held)
+            pa_idxset_free(router->trans.held, NULL);
 
+        if (router->propdefer)
+            u->core->mainloop->defer_free(router->propdefer);
+
+        pa_xfree(router->plan.entries);
+        pa_xfree(router->classmap);
         pa_xfree(router->priormap);
         pa_xfree(router);
 
@@ -175,8 +241,10 @@ mir_rtgroup *mir_router_create_rtgroup(struct userdata      *u,
 
     rtg = pa_xnew0(mir_rtgroup, 1);
     rtg->name    = pa_xstrdup(name);
+    rtg->type    = type;
     rtg->accept  = accept;
     rtg->compare = compare;
+    rtg->key     = rtgroup_builtin_key(compare);
     MIR_DLIST_INIT(rtg->entries);
 
     if (pa_hashmap_put(table, rtg->name, rtg) < 0) {
@@ -229,8 +297,6 @@ bool mir_router_assign_class_to_rtgroup(struct userdata *u,
 {
     pa_router *router;
     pa_hashmap *rtable;
-    mir_rtgroup ***classmap;
-    mir_rtgroup **zonemap;
     mir_rtgroup *rtg;
     const char *clnam;
     const char *direction;
@@ -242,14 +308,10 @@ bool mir_router_assign_class_to_rtgroup(struct userdata *u,
     pa_assert(rtgrpnam);
     pa_assert_se((router = u->router));
 
-    if (type == mir_input) {
-        rtable   = router->rtgroups.input;
-        classmap = router->classmap.input;
-    }
-    else {
-        rtable   = router->rtgroups.output;
-        classmap = router->classmap.output;
-    }
+    if (type == mir_input)
+        rtable = router->rtgroups.input;
+    else
+        rtable = router->rtgroups.output;
 
     if (class < 0 || class >= router->maplen) {
         pa_log_debug("can't assign class (%d) to  routing group '%s': "
@@ -266,12 +328,9 @@ bool mir_router_assign_class_to_rtgroup(struct userdata *u,
                      "router group not found", clnam, direction, rtgrpnam);
     }
 
-    if (!(zonemap = classmap[zone])) {
-        zonemap = pa_xnew0(mir_rtgroup *, router->maplen);
-        classmap[zone] = zonemap;
-    }
+    *classmap_entry(router, zone, type, class) = rtg;
 
-    zonemap[class] = rtg;
+    mir_router_mark_all_dirty(u);
 
     if ((z = pa_zoneset_get_zone_by_index(u, zone))) {
         pa_log_debug("class '%s'@'%s' assigned to %s routing group '%s'",
@@ -288,12 +347,30 @@ bool mir_router_assign_class_to_rtgroup(struct userdata *u,
 
 
 void mir_router_register_node(struct userdata *u, mir_node *node)
+{
+    pa_router *router;
+
+    pa_assert(u);
+    pa_assert(node);
+    pa_assert_se((router = u->router));
+
+    /*
+     * while routing is held the devices are only collected and get
+     * registered in bulk when the hold is released
+     */
+    if (router->trans.hold && node->implement == mir_device) {
+        pa_idxset_put(router->trans.held, node, NULL);
+        return;
+    }
+
+    register_node(u, node);
+}
+
+static void register_node(struct userdata *u, mir_node *node)
 {
     pa_router   *router;
     mir_rtgroup *rtg;
     void        *state;
-    int          priority;
-    mir_node    *before;
 
     pa_assert(u);
     pa_assert(node);
@@ -325,35 +402,126 @@ void mir_router_register_node(struct userdata *u, mir_node *node)
                 return;
         }
 
-        priority = node_priority(u, node);
+        add_to_nodlist(u, node);
 
-        MIR_DLIST_FOR_EACH(mir_node, rtprilist, before, &router->nodlist) {
-            if (priority < node_priority(u, before)) {
-                MIR_DLIST_INSERT_BEFORE(mir_node, rtprilist, node,
-                                        &before->rtprilist);
-                return;
-            }
-        }
+        return;
+    }
+}
 
-        MIR_DLIST_APPEND(mir_node, rtprilist, node, &router->nodlist);
+static uint32_t register_held_nodes(struct userdata *u)
+{
+    pa_router   *router;
+    mir_rtgroup *rtg;
+    void        *state;
+    mir_node   **nodes;
+    mir_node    *node;
+    uint32_t     nnode, i;
 
-        return;
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+
+    if (!(nnode = pa_idxset_size(router->trans.held)))
+        return 0;
+
+    nodes = pa_xnew(mir_node *, nnode);
+
+    /* in the order they were registered */
+    for (i = 0;  (node = pa_idxset_steal_first(router->trans.held, NULL));  i++)
+        nodes[i] = node;
+
+    pa_assert(i == nnode);
+
+    PA_HASHMAP_FOREACH(rtg, router->rtgroups.output, state) {
+        add_rtentries(u, mir_output, rtg, nodes, nnode);
+    }
+
+    PA_HASHMAP_FOREACH(rtg, router->rtgroups.input, state) {
+        add_rtentries(u, mir_input, rtg, nodes, nnode);
+    }
+
+    for (i = 0;  i < nnode;  i++) {
+        node = nodes[i];
+
+        if (node->direction == mir_input && pa_classify_loopback_stream(node))
+            add_to_nodlist(u, node);
+    }
+
+    pa_xfree(nodes);
+
+    router->stats.held += nnode;
+    router->stats.bulks++;
+
+    pa_log_debug("%u held device node(s) registered in bulk", nnode);
+
+    return nnode;
+}
+
+static void add_to_nodlist(struct userdata *u, mir_node *node)
+{
+    pa_router *router;
+    mir_node  *before;
+    int        priority;
+
+    pa_assert(u);
+    pa_assert(node);
+    pa_assert_se((router = u->router));
+
+    priority = node_priority(u, node);
+
+    MIR_DLIST_FOR_EACH(mir_node, rtprilist, before, &router->nodlist) {
+        if (priority < node_priority(u, before)) {
+            MIR_DLIST_INSERT_BEFORE(mir_node, rtprilist, node,
+                                    &before->rtprilist);
+            return;
+        }
     }
+
+    MIR_DLIST_APPEND(mir_node, rtprilist, node, &router->nodlist);
 }
 
 void mir_router_unregister_node(struct userdata *u, mir_node *node)
 {
     pa_router *router;
     mir_rtentry *rte, *n;
+    mir_connection *conn, *c;
+    mir_node *end;
 
     pa_assert(u);
     pa_assert(node);
     pa_assert_se((router = u->router));
 
+    pa_idxset_remove_by_data(router->trans.held, node, NULL);
+
+    /* the device doesn't need to be limited for the stream any more */
+    if (node->implement == mir_stream && node->direction == mir_input &&
+        (end = mir_node_find_by_index(u, node->rtarget)))
+    {
+        mir_volume_remove_limiting_class(u, end, volume_class(node),
+                                         router->plan.stamp);
+        pa_fader_mark_device_dirty(u, end);
+    }
+
+    /* the plan might point to the node; the next pass makes a new one */
+    router->plan.nentry = 0;
+
     MIR_DLIST_FOR_EACH_SAFE(mir_rtentry,nodchain, rte,n, &node->rtentries) {
         remove_rtentry(u, rte);
     }
 
+    /* the explicit routes of the node stay until the audio manager
+       removes them, but they can't be set up anymore */
+    MIR_DLIST_FOR_EACH_SAFE(mir_connection,fromchain, conn,c, &node->connfrom){
+        MIR_DLIST_UNLINK(mir_connection, fromchain, conn);
+        conn->fromnode = NULL;
+        conn->applied = 0;
+    }
+
+    MIR_DLIST_FOR_EACH_SAFE(mir_connection,tochain, conn,c, &node->connto) {
+        MIR_DLIST_UNLINK(mir_connection, tochain, conn);
+        conn->tonode = NULL;
+        conn->applied = 0;
+    }
+
     MIR_DLIST_UNLINK(mir_node, rtprilist, node);
 }
 
@@ -372,13 +540,21 @@ mir_connection *mir_router_add_explicit_route(struct userdata *u,
 
     conn = pa_xnew0(mir_connection, 1);
     MIR_DLIST_INIT(conn->link);
+    MIR_DLIST_INIT(conn->fromchain);
+    MIR_DLIST_INIT(conn->tochain);
     conn->amid = amid;
     conn->from = from->index;
     conn->to = to->index;
+    conn->fromnode = from;
+    conn->tonode = to;
 
     MIR_DLIST_APPEND(mir_connection, link, conn, &router->connlist);
+    MIR_DLIST_APPEND(mir_connection, fromchain, conn, &from->connfrom);
+    MIR_DLIST_APPEND(mir_connection, tochain, conn, &to->connto);
 
-    mir_router_make_routing(u);
+    mir_router_mark_node_dirty(u, from);
+    mir_router_mark_node_dirty(u, to);
+    mir_router_make_incremental_routing(u);
 
     return conn;
 }
@@ -396,10 +572,9 @@ void mir_router_remove_explicit_route(struct userdata *u, mir_connection *conn)
     pa_assert_se((router = u->router));
 
     MIR_DLIST_UNLINK(mir_connection, link, conn);
+    connection_unlink_nodes(conn);
 
-    if (!(from = mir_node_find_by_index(u, conn->from)) ||
-        !(to   = mir_node_find_by_index(u, conn->to))     )
-    {
+    if (!(from = conn->fromnode) || !(to = conn->tonode)) {
         pa_log_debug("can't remove explicit route: some node was not found");
     }
     else {
@@ -410,8 +585,11 @@ void mir_router_remove_explicit_route(struct userdata *u, mir_connection *conn)
                          "failed to teardown link");
         }
         else {
-            if (!conn->blocked)
-                mir_router_make_routing(u);
+            if (!conn->blocked) {
+                mir_router_mark_node_dirty(u, from);
+                mir_router_mark_node_dirty(u, to);
+                mir_router_make_incremental_routing(u);
+            }
         }
     }
 
@@ -462,8 +640,37 @@ mir_node *mir_router_make_prerouting(struct userdata *u, mir_node *data)
     target = NULL;
     stamp = pa_utils_new_stamp();
 
+    router->stats.preroutes++;
+
+    /* the explicit routes constrain the default ones in both cases */
     make_explicit_routes(u, stamp);
 
+    if (preroute_is_local(u, data, priority)) {
+        /*
+         * the new stream can't displace anybody, so the routes of the
+         * others stay. Their devices still put constraints on the new
+         * stream, though.
+         */
+        router->stats.shortcuts++;
+
+        MIR_DLIST_FOR_EACH_BACKWARD(mir_node,rtprilist, start,&router->nodlist){
+            if (start->implement == mir_device && !start->loop)
+                continue;
+            if (start->stamp >= stamp)
+                continue;       /* explicitly routed */
+            keep_default_route(u, start, stamp);
+        }
+
+        if ((target = find_default_route(u, data, stamp)))
+            implement_preroute(u, data, target, stamp);
+
+        pa_log_debug("pre-routed '%s' without rerouting (%u of %u)",
+                     data->amname, router->stats.shortcuts,
+                     router->stats.preroutes);
+
+        return target;
+    }
+
     MIR_DLIST_FOR_EACH_BACKWARD(mir_node, rtprilist, start, &router->nodlist) {
         if (start->implement == mir_device) {
 #if 0
@@ -496,48 +703,141 @@ mir_node *mir_router_make_prerouting(struct userdata *u, mir_node *data)
 }
 
 
-void mir_router_make_routing(struct userdata *u)
+void mir_router_mark_node_dirty(struct userdata *u, mir_node *node)
 {
-    static bool ongoing_routing;
+    pa_assert(u);
+    pa_assert(node);
 
-    pa_router  *router;
-    mir_node   *start;
-    mir_node   *end;
-    uint32_t    stamp;
+    if (node->implement == mir_device) {
+        update_node_routable(node);
+        forget_links(u, node);
+        pa_fader_mark_device_dirty(u, node);
+    }
+
+    invalidate_connections(node);
+    mark_node_dirty(u, node);
+}
+
+void mir_router_stream_moved(struct userdata *u,
+                             mir_node        *node,
+                             uint32_t         paidx)
+{
+    mir_node *target;
 
     pa_assert(u);
-    pa_assert_se((router = u->router));
+    pa_assert(node);
+
+    if (!MIR_DLIST_EMPTY(node->connfrom) || !MIR_DLIST_EMPTY(node->connto)) {
+        /* somebody else moved the stream; snap it back to its explicit route */
+        pa_log_debug("explicitly routed stream '%s' was moved", node->amname);
 
-    if (ongoing_routing)
+        invalidate_connections(node);
+        request_routing(u);
         return;
+    }
 
-    ongoing_routing = true;
-    stamp = pa_utils_new_stamp();
+    if (!(target = mir_node_find_by_index(u, node->rtarget)))
+        return;
 
-    make_explicit_routes(u, stamp);
+    /*
+     * our own moves happen after rtarget was set, so they land where the
+     * default route points to. Anything else was a move by somebody else
+     */
+    if (target->paidx == paidx || (node->mux && node->mux->sink_index == paidx))
+        return;
 
-    MIR_DLIST_FOR_EACH_BACKWARD(mir_node,rtprilist, start, &router->nodlist) {
-        if (start->implement == mir_device) {
-#if 0
-            if (start->direction == mir_output)
-                continue;       /* we should never get here */
-            if (!start->mux && !start->loop)
-                continue;       /* skip not looped back input nodes */
-#endif
-            if (!start->loop)
-                continue;       /* only looped back devices routed here */
-        }
+    pa_log_debug("default routed stream '%s' was moved", node->amname);
 
-        if (start->stamp >= stamp)
-            continue;
+    node->rtlink = PA_IDXSET_INVALID;
+    pa_fader_mark_device_dirty(u, target);
+    mark_node_dirty(u, node);
+    request_routing(u);
+}
 
-        if ((end = find_default_route(u, start, stamp)))
-            implement_default_route(u, start, end, stamp);
+void mir_router_mark_all_dirty(struct userdata *u)
+{
+    pa_router *router;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+
+    router->dirty.all = true;
+}
+
+void mir_router_note_device_event(struct userdata *u, pa_usec_t when)
+{
+    pa_router *router;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+
+    /* the latency is measured from the oldest event of the pass */
+    if (!router->trans.event || when < router->trans.event)
+        router->trans.event = when;
+}
+
+void mir_router_make_routing(struct userdata *u)
+{
+    pa_assert(u);
+
+    mir_router_mark_all_dirty(u);
+    request_routing(u);
+}
+
+void mir_router_make_incremental_routing(struct userdata *u)
+{
+    pa_assert(u);
+
+    request_routing(u);
+}
+
+void mir_router_flush_routing(struct userdata *u)
+{
+    pa_router *router;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+
+    if (router->trans.requested != router->trans.served &&
+        !router->trans.ongoing)
+    {
+        make_routing(u);
     }
+}
 
-    pa_fader_apply_volume_limits(u, stamp);
+void mir_router_hold_routing(struct userdata *u)
+{
+    pa_router *router;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+
+    router->trans.hold++;
+}
+
+bool mir_router_release_routing(struct userdata *u)
+{
+    pa_router *router;
+    uint32_t nheld;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+    pa_assert(router->trans.hold > 0);
 
-    ongoing_routing = false;
+    if (--router->trans.hold > 0)
+        return false;
+
+    if ((nheld = register_held_nodes(u)) > 0)
+        request_routing(u);
+
+    /* the requests of the hold are served by a single pass */
+    if (router->trans.requested == router->trans.served)
+        return false;
+
+    if (!router->trans.ongoing)
+        u->core->mainloop->defer_enable(router->trans.defer, 1);
+
+    return true;
 }
 
 
@@ -618,9 +918,6 @@ int mir_router_default_compare(struct userdata *u, mir_rtgroup *rtg,
 {
     uint32_t p1, p2;
 
-    (void)u;
-    (void)rtg;
-
     pa_assert(n1);
     pa_assert(n2);
 
@@ -629,11 +926,8 @@ int mir_router_default_compare(struct userdata *u, mir_rtgroup *rtg,
     if (n2->type == mir_null)
         return 1;
 
-    p1 = ((((n1->channels & 31) << 5) + n1->privacy) << 2) + n1->location;
-    p2 = ((((n2->channels & 31) << 5) + n2->privacy) << 2) + n2->location;
-
-    p1 = (p1 << 8) + ((n1->type - mir_device_class_begin) & 0xff);
-    p2 = (p2 << 8) + ((n2->type - mir_device_class_begin) & 0xff);
+    p1 = mir_router_default_key(u, rtg, n1);
+    p2 = mir_router_default_key(u, rtg, n2);
 
     return uint32_cmp(p1,p2);
 }
@@ -644,9 +938,6 @@ int mir_router_phone_compare(struct userdata *u, mir_rtgroup *rtg,
 {
     uint32_t p1, p2;
 
-    (void)u;
-    (void)rtg;
-
     pa_assert(n1);
     pa_assert(n2);
 
@@ -655,13 +946,52 @@ int mir_router_phone_compare(struct userdata *u, mir_rtgroup *rtg,
     if (n2->type == mir_null)
         return 1;
 
-    p1 = (n1->privacy << 8) + ((n1->type - mir_device_class_begin) & 0xff);
-    p2 = (n2->privacy << 8) + ((n2->type - mir_device_class_begin) & 0xff);
+    p1 = mir_router_phone_key(u, rtg, n1);
+    p2 = mir_router_phone_key(u, rtg, n2);
 
     return uint32_cmp(p1,p2);
 }
 
 
+uint32_t mir_router_default_key(struct userdata *u, mir_rtgroup *rtg,
+                                mir_node *node)
+{
+    uint32_t p;
+
+    (void)u;
+    (void)rtg;
+
+    pa_assert(node);
+
+    if (node->type == mir_null)
+        return 0;               /* null devices are the last resort */
+
+    p = ((((node->channels & 31) << 5) + node->privacy) << 2) + node->location;
+    p = (p << 8) + ((node->type - mir_device_class_begin) & 0xff);
+
+    return p + 1;
+}
+
+
+uint32_t mir_router_phone_key(struct userdata *u, mir_rtgroup *rtg,
+                              mir_node *node)
+{
+    uint32_t p;
+
+    (void)u;
+    (void)rtg;
+
+    pa_assert(node);
+
+    if (node->type == mir_null)
+        return 0;
+
+    p = (node->privacy << 8) + ((node->type - mir_device_class_begin) & 0xff);
+
+    return p + 1;
+}
+
+
 static void rtgroup_destroy(struct userdata *u, mir_rtgroup *rtg)
 {
     mir_rtentry *rte, *n;
@@ -673,6 +1003,12 @@ static void rtgroup_destroy(struct userdata *u, mir_rtgroup *rtg)
         remove_rtentry(u, rte);
     }
 
+    /* the group won't be around when the pending update gets done */
+    if (rtg->propdirty)
+        rtgroup_update_module_property(u, rtg->type, rtg);
+
+    pa_xfree(rtg->index);
+    pa_xfree(rtg->routable);
     pa_xfree(rtg->name);
     pa_xfree(rtg);
 }
@@ -719,64 +1055,698 @@ static void rtgroup_update_module_property(struct userdata *u,
         value[1] = 0;
 
     pa_proplist_sets(module->proplist, key, value+1); /* skip ' '@beginning */
+
+    rtg->propdirty = false;
 }
 
-static void add_rtentry(struct userdata *u,
-                        mir_direction    type,
-                        mir_rtgroup     *rtg,
-                        mir_node        *node)
+static void rtgroup_mark_property_dirty(struct userdata *u, mir_rtgroup *rtg)
+{
+    pa_router *router = u->router;
+
+    if (!rtg->propdirty) {
+        rtg->propdirty = true;
+        u->core->mainloop->defer_enable(router->propdefer, 1);
+    }
+}
+
+static void property_event_cb(pa_mainloop_api *m, pa_defer_event *e, void *d)
 {
+    struct userdata *u = d;
     pa_router *router;
-    mir_rtentry *rte, *before;
+    mir_rtgroup *rtg;
+    void *state;
 
+    pa_assert(m);
     pa_assert(u);
-    pa_assert(rtg);
-    pa_assert(node);
     pa_assert_se((router = u->router));
 
-    if (!rtg->accept(u, rtg, node)) {
-        pa_log_debug("refuse node '%s' registration to routing group '%s'",
-                     node->amname, rtg->name);
-        return;
-    }
-
-    rte = pa_xnew0(mir_rtentry, 1);
+    m->defer_enable(e, 0);
 
-    MIR_DLIST_APPEND(mir_rtentry, nodchain, rte, &node->rtentries);
-    rte->group = rtg;
-    rte->node  = node;
+    PA_HASHMAP_FOREACH(rtg, router->rtgroups.input, state) {
+        if (rtg->propdirty)
+            rtgroup_update_module_property(u, mir_input, rtg);
+    }
 
-    MIR_DLIST_FOR_EACH(mir_rtentry, link, before, &rtg->entries) {
-        if (rtg->compare(u, rtg, node, before->node) < 0) {
-            MIR_DLIST_INSERT_BEFORE(mir_rtentry, link, rte, &before->link);
-            goto added;
-        }
+    PA_HASHMAP_FOREACH(rtg, router->rtgroups.output, state) {
+        if (rtg->propdirty)
+            rtgroup_update_module_property(u, mir_output, rtg);
     }
+}
 
-    MIR_DLIST_APPEND(mir_rtentry, link, rte, &rtg->entries);
+static mir_rtgroup_key_t rtgroup_builtin_key(mir_rtgroup_compare_t compare)
+{
+    if (compare == mir_router_default_compare)
+        return mir_router_default_key;
+    if (compare == mir_router_phone_compare)
+        return mir_router_phone_key;
 
- added:
-    rtgroup_update_module_property(u, type, rtg);
-    pa_log_debug("node '%s' added to routing group '%s'",
-                 node->amname, rtg->name);
+    return NULL;
 }
 
-static void remove_rtentry(struct userdata *u, mir_rtentry *rte)
+static bool rtentry_before(struct userdata *u,
+                           mir_rtgroup     *rtg,
+                           mir_rtentry     *rte,
+                           mir_rtentry     *e)
 {
-    mir_rtgroup *rtg;
-    mir_node    *node;
+    if (rtg->key)
+        return rte->key < e->key;
 
-    pa_assert(u);
-    pa_assert(rte);
-    pa_assert_se((rtg = rte->group));
-    pa_assert_se((node = rte->node));
+    return rtg->compare(u, rtg, rte->node, e->node) < 0;
+}
 
-    MIR_DLIST_UNLINK(mir_rtentry, link, rte);
+static size_t rtgroup_find_position(struct userdata *u,
+                                    mir_rtgroup     *rtg,
+                                    mir_rtentry     *rte)
+{
+    size_t lo, hi, mid;
+
+    /*
+     * binary search for the first entry that sorts after the new one;
+     * equal entries keep their insertion order
+     */
+    lo = 0;
+    hi = rtg->nentry;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (rtentry_before(u, rtg, rte, rtg->index[mid]))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+static size_t rtgroup_index_of(mir_rtgroup *rtg, mir_rtentry *rte)
+{
+    size_t lo, hi, mid, i;
+
+    /*
+     * keyed groups narrow the search to the entries of the same key;
+     * groups ordered by a Lua compare function are scanned linearly
+     */
+    lo = 0;
+    hi = rtg->nentry;
+
+    if (rtg->key) {
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+
+            if (rtg->index[mid]->key < rte->key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+
+    for (i = lo;  i < rtg->nentry;  i++) {
+        if (rtg->index[i] == rte)
+            return i;
+    }
+
+    return rtg->nentry;
+}
+
+static bool rtentry_routable(mir_rtentry *rte)
+{
+    mir_node *node = rte->node;
+
+    if (node->ignore || !node->available)
+        return false;
+
+    if (node->paidx == PA_IDXSET_INVALID && !node->paport) {
+        /* requires profile change. We do it only for BT headsets */
+        if (node->type != mir_bluetooth_a2dp &&
+            node->type != mir_bluetooth_sco    )
+            return false;
+    }
+
+    return true;
+}
+
+static void rtgroup_set_routable(mir_rtgroup *rtg, size_t pos, bool routable)
+{
+    uint32_t bit = ((uint32_t)1) << (pos % 32);
+
+    if (routable)
+        rtg->routable[pos / 32] |= bit;
+    else
+        rtg->routable[pos / 32] &= ~bit;
+}
+
+static void rtgroup_update_routable(mir_rtgroup *rtg)
+{
+    size_t i;
+
+    memset(rtg->routable, 0,
+           sizeof(uint32_t) * ROUTABLE_WORDS(rtg->maxentry));
+
+    for (i = 0;  i < rtg->nentry;  i++)
+        rtgroup_set_routable(rtg, i, rtentry_routable(rtg->index[i]));
+}
+
+static void rtgroup_insert_routable(mir_rtgroup *rtg,
+                                    size_t       pos,
+                                    bool         routable)
+{
+    size_t   w, w0;
+    uint32_t low;
+
+    /*
+     * the bits from pos up move one position higher; nentry already
+     * counts the new entry. O(nentry / 32) word shifts.
+     */
+    w0  = pos / 32;
+    low = (((uint32_t)1) << (pos % 32)) - 1;
+
+    for (w = ROUTABLE_WORDS(rtg->nentry) - 1;  w > w0;  w--)
+        rtg->routable[w] = (rtg->routable[w] << 1) | (rtg->routable[w-1] >> 31);
+
+    rtg->routable[w0] = (rtg->routable[w0] & low) |
+                        ((rtg->routable[w0] & ~low) << 1);
+
+    rtgroup_set_routable(rtg, pos, routable);
+}
+
+static void rtgroup_remove_routable(mir_rtgroup *rtg, size_t pos)
+{
+    size_t   w, w0, nword;
+    uint32_t low;
+
+    /* the bits above pos move one position lower; nentry is the old one */
+    nword = ROUTABLE_WORDS(rtg->nentry);
+    w0    = pos / 32;
+    low   = (((uint32_t)1) << (pos % 32)) - 1;
+
+    rtg->routable[w0] = (rtg->routable[w0] & low) |
+                        ((rtg->routable[w0] >> 1) & ~low);
+
+    for (w = w0;  w < nword;  w++) {
+        if (w > w0)
+            rtg->routable[w] >>= 1;
+        if (w + 1 < nword)
+            rtg->routable[w] |= rtg->routable[w+1] << 31;
+    }
+}
+
+static size_t rtgroup_last_routable(mir_rtgroup *rtg, size_t limit)
+{
+    size_t w;
+    uint32_t bits;
+
+    /* the highest routable position below limit, or nentry if none */
+
+    if (!limit)
+        return rtg->nentry;
+
+    w = (limit - 1) / 32;
+    bits = rtg->routable[w] & (~((uint32_t)0) >> (31 - (limit - 1) % 32));
+
+    for (;;) {
+        if (bits)
+            return w * 32 + pa_ulog2(bits);
+        if (!w)
+            return rtg->nentry;
+
+        bits = rtg->routable[--w];
+    }
+}
+
+static void update_node_routable(mir_node *node)
+{
+    mir_rtentry *rte;
+    mir_rtgroup *rtg;
+    size_t pos;
+
+    MIR_DLIST_FOR_EACH(mir_rtentry, nodchain, rte, &node->rtentries) {
+        rtg = rte->group;
+
+        if ((pos = rtgroup_index_of(rtg, rte)) < rtg->nentry)
+            rtgroup_set_routable(rtg, pos, rtentry_routable(rte));
+    }
+}
+
+static mir_rtgroup **classmap_entry(pa_router     *router,
+                                    uint32_t       zone,
+                                    mir_direction  type,
+                                    mir_node_type  class)
+{
+    size_t dir = (type == mir_input) ? 0 : 1;
+
+    pa_assert(zone < MRP_ZONE_MAX);
+    pa_assert(class >= 0 && class < (int)router->maplen);
+
+    return router->classmap + ((zone * 2 + dir) * router->maplen + class);
+}
+
+static void add_rtentry(struct userdata *u,
+                        mir_direction    type,
+                        mir_rtgroup     *rtg,
+                        mir_node        *node)
+{
+    pa_router *router;
+    mir_rtentry *rte;
+    size_t pos, nword;
+
+    pa_assert(u);
+    pa_assert(rtg);
+    pa_assert(node);
+    pa_assert_se((router = u->router));
+
+    if (!rtg->accept(u, rtg, node)) {
+        pa_log_debug("refuse node '%s' registration to routing group '%s'",
+                     node->amname, rtg->name);
+        return;
+    }
+
+    rte = pa_xnew0(mir_rtentry, 1);
+
+    MIR_DLIST_APPEND(mir_rtentry, nodchain, rte, &node->rtentries);
+    rte->group = rtg;
+    rte->node  = node;
+    rte->key   = rtg->key ? rtg->key(u, rtg, node) : 0;
+
+    /*
+     * the position is found in O(log n) but the index and the routable
+     * bits below it still shift by one, which is O(n): a pointer move
+     * per entry and a word shift per 32 entries
+     */
+    pos = rtgroup_find_position(u, rtg, rte);
+
+    if (rtg->nentry >= rtg->maxentry) {
+        nword = ROUTABLE_WORDS(rtg->maxentry);
+        rtg->maxentry += RTGROUP_INDEX_BUCKET;
+        rtg->index = pa_xrealloc(rtg->index,
+                                 sizeof(mir_rtentry *) * rtg->maxentry);
+        rtg->routable = pa_xrealloc(rtg->routable, sizeof(uint32_t) *
+                                    ROUTABLE_WORDS(rtg->maxentry));
+        memset(rtg->routable + nword, 0, sizeof(uint32_t) *
+               (ROUTABLE_WORDS(rtg->maxentry) - nword));
+    }
+
+    if (pos < rtg->nentry) {
+        MIR_DLIST_INSERT_BEFORE(mir_rtentry, link, rte,
+                                &rtg->index[pos]->link);
+        memmove(rtg->index + pos + 1, rtg->index + pos,
+                sizeof(mir_rtentry *) * (rtg->nentry - pos));
+    }
+    else {
+        MIR_DLIST_APPEND(mir_rtentry, link, rte, &rtg->entries);
+    }
+
+    rtg->index[pos] = rte;
+    rtg->nentry++;
+
+    rtgroup_insert_routable(rtg, pos, rtentry_routable(rte));
+
+    mark_rtgroup_dirty(u, type, rtg);
+    rtgroup_mark_property_dirty(u, rtg);
+    pa_log_debug("node '%s' added to routing group '%s'",
+                 node->amname, rtg->name);
+}
+
+static void add_rtentries(struct userdata *u,
+                          mir_direction    type,
+                          mir_rtgroup     *rtg,
+                          mir_node       **nodes,
+                          uint32_t         nnode)
+{
+    mir_rtentry **added;
+    mir_rtentry **index;
+    mir_rtentry  *rte;
+    mir_node     *node;
+    uint32_t      nadded, i, j;
+    size_t        maxentry, n, k, m;
+
+    pa_assert(u);
+    pa_assert(rtg);
+    pa_assert(nodes);
+
+    added  = pa_xnew(mir_rtentry *, nnode);
+    nadded = 0;
+
+    for (i = 0;  i < nnode;  i++) {
+        node = nodes[i];
+
+        if (node->direction != type)
+            continue;
+
+        if (!rtg->accept(u, rtg, node)) {
+            pa_log_debug("refuse node '%s' registration to routing group "
+                         "'%s'", node->amname, rtg->name);
+            continue;
+        }
+
+        rte = pa_xnew0(mir_rtentry, 1);
+
+        MIR_DLIST_APPEND(mir_rtentry, nodchain, rte, &node->rtentries);
+        rte->group = rtg;
+        rte->node  = node;
+        rte->key   = rtg->key ? rtg->key(u, rtg, node) : 0;
+
+        /* stable insertion sort of the new entries */
+        for (j = nadded;  j > 0 && rtentry_before(u, rtg, rte, added[j-1]);  j--)
+            added[j] = added[j-1];
+
+        added[j] = rte;
+        nadded++;
+    }
+
+    if (nadded > 0) {
+        for (maxentry = rtg->maxentry;  rtg->nentry + nadded > maxentry;  )
+            maxentry += RTGROUP_INDEX_BUCKET;
+
+        index = pa_xnew(mir_rtentry *, maxentry);
+
+        /*
+         * a single merge of the sorted new entries into the index;
+         * equal entries keep their registration order
+         */
+        for (n = k = m = 0;  n < rtg->nentry || k < nadded;  m++) {
+            if (k >= nadded || (n < rtg->nentry &&
+                                !rtentry_before(u, rtg, added[k],
+                                                rtg->index[n])))
+                index[m] = rtg->index[n++];
+            else
+                index[m] = added[k++];
+        }
+
+        pa_xfree(rtg->index);
+        rtg->index  = index;
+        rtg->nentry = m;
+
+        if (maxentry != rtg->maxentry) {
+            rtg->maxentry = maxentry;
+            rtg->routable = pa_xrealloc(rtg->routable, sizeof(uint32_t) *
+                                        ROUTABLE_WORDS(rtg->maxentry));
+        }
+
+        MIR_DLIST_INIT(rtg->entries);
+
+        for (n = 0;  n < rtg->nentry;  n++)
+            MIR_DLIST_APPEND(mir_rtentry, link, rtg->index[n], &rtg->entries);
+
+        rtgroup_update_routable(rtg);
+
+        mark_rtgroup_dirty(u, type, rtg);
+        rtgroup_mark_property_dirty(u, rtg);
+        pa_log_debug("%u node(s) added to routing group '%s'",
+                     nadded, rtg->name);
+    }
+
+    pa_xfree(added);
+}
+
+static void remove_rtentry(struct userdata *u, mir_rtentry *rte)
+{
+    mir_rtgroup *rtg;
+    mir_node    *node;
+    size_t       pos;
+
+    pa_assert(u);
+    pa_assert(rte);
+    pa_assert_se((rtg = rte->group));
+    pa_assert_se((node = rte->node));
+
+    MIR_DLIST_UNLINK(mir_rtentry, link, rte);
     MIR_DLIST_UNLINK(mir_rtentry, nodchain, rte);
 
+    if ((pos = rtgroup_index_of(rtg, rte)) < rtg->nentry) {
+        rtgroup_remove_routable(rtg, pos);
+        rtg->nentry--;
+        memmove(rtg->index + pos, rtg->index + pos + 1,
+                sizeof(mir_rtentry *) * (rtg->nentry - pos));
+    }
+
     pa_xfree(rte);
 
-    rtgroup_update_module_property(u, node->direction, rtg);
+    mark_rtgroup_dirty(u, node->direction, rtg);
+    rtgroup_mark_property_dirty(u, rtg);
+}
+
+static void mark_rtgroup_dirty(struct userdata *u,
+                               mir_direction    type,
+                               mir_rtgroup     *rtg)
+{
+    pa_router     *router;
+    uint32_t      *dirty;
+    uint32_t       zone;
+    size_t         class;
+
+    pa_assert(u);
+    pa_assert(rtg);
+    pa_assert_se((router = u->router));
+
+    if (type == mir_input)
+        dirty = router->dirty.input;
+    else
+        dirty = router->dirty.output;
+
+    for (zone = 0;  zone < MRP_ZONE_MAX;  zone++) {
+        for (class = 0;  class < router->maplen;  class++) {
+            if (*classmap_entry(router, zone, type, class) == rtg)
+                dirty[zone] |= CLASS_BIT(class);
+        }
+    }
+}
+
+static void mark_device_dirty(struct userdata *u, mir_node *node)
+{
+    mir_rtentry *rte;
+
+    MIR_DLIST_FOR_EACH(mir_rtentry, nodchain, rte, &node->rtentries) {
+        mark_rtgroup_dirty(u, node->direction, rte->group);
+    }
+}
+
+static void mark_node_dirty(struct userdata *u, mir_node *node)
+{
+    pa_router        *router = u->router;
+    mir_constr_link  *cl;
+    mir_constr_link  *c;
+    mir_zone         *zone;
+    int               class;
+    uint32_t         *dirty;
+
+    if (router->dirty.all)
+        return;
+
+    if (node->implement == mir_device) {
+        /*
+         * the availability of a device affects the rtgroups it is in,
+         * and through the constraints the rtgroups of its peers as well
+         */
+        mark_device_dirty(u, node);
+
+        MIR_DLIST_FOR_EACH(mir_constr_link, nodchain, cl, &node->constrains) {
+            MIR_DLIST_FOR_EACH(mir_constr_link, link, c, &cl->def->nodes) {
+                if (c->node != node)
+                    mark_device_dirty(u, c->node);
+            }
+        }
+    }
+    else {
+        class = pa_classify_guess_application_class(node);
+        zone  = pa_zoneset_get_zone_by_name(u, node->zone);
+
+        if (class < 0 || class >= (int)router->maplen || !zone) {
+            router->dirty.all = true;
+            return;
+        }
+
+        if (node->direction == mir_input)
+            dirty = router->dirty.output;
+        else
+            dirty = router->dirty.input;
+
+        dirty[zone->index] |= CLASS_BIT(class);
+    }
+}
+
+static bool stream_is_dirty(struct userdata *u, mir_node *start)
+{
+    pa_router *router = u->router;
+    mir_zone  *zone;
+    int        class;
+    uint32_t  *dirty;
+
+    if (router->dirty.all || start->rtarget == PA_IDXSET_INVALID)
+        return true;
+
+    class = pa_classify_guess_application_class(start);
+    zone  = pa_zoneset_get_zone_by_name(u, start->zone);
+
+    if (class < 0 || class >= (int)router->maplen || !zone)
+        return true;
+
+    if (start->direction == mir_input)
+        dirty = router->dirty.output;
+    else
+        dirty = router->dirty.input;
+
+    return (dirty[zone->index] & CLASS_BIT(class)) ? true : false;
+}
+
+static void clear_dirty(struct userdata *u)
+{
+    pa_router *router = u->router;
+
+    memset(&router->dirty, 0, sizeof(router->dirty));
+}
+
+static void request_routing(struct userdata *u)
+{
+    pa_router *router = u->router;
+
+    router->stats.requests++;
+
+    /*
+     * all requests raised in the same mainloop iteration are served by
+     * a single pass. Requests raised while a pass is ongoing are not
+     * dropped but make the pass run again in the next iteration.
+     */
+    if (router->trans.requested != router->trans.served)
+        router->stats.saved++;
+    else if (!router->trans.ongoing && !router->trans.hold)
+        u->core->mainloop->defer_enable(router->trans.defer, 1);
+
+    router->trans.requested++;
+}
+
+static void routing_event_cb(pa_mainloop_api *m, pa_defer_event *e, void *d)
+{
+    struct userdata *u = d;
+
+    pa_assert(m);
+    pa_assert(u);
+
+    m->defer_enable(e, 0);
+
+    pa_log_debug("deferred routing starts");
+
+    mir_router_flush_routing(u);
+}
+
+static void make_routing(struct userdata *u)
+{
+    pa_router  *router;
+    mir_node   *start;
+    mir_node   *end;
+    mir_node   *prev;
+    uint32_t    stamp;
+    uint32_t    total;
+    pa_usec_t   latency;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+    pa_assert(!router->trans.ongoing);
+
+    router->trans.ongoing = true;
+    router->trans.served = router->trans.requested;
+    stamp = pa_utils_new_stamp();
+
+    router->stats.passes++;
+    router->stats.touched = 0;
+    router->stats.kept = 0;
+    router->stats.linked = 0;
+    router->stats.unchanged = 0;
+
+    router->plan.stamp = stamp;
+    router->plan.nentry = 0;
+
+    make_explicit_routes(u, stamp);
+
+    /*
+     * planning: decide the default route of every stream in priority
+     * order. Nothing is done to the streams and devices here.
+     */
+    MIR_DLIST_FOR_EACH_BACKWARD(mir_node,rtprilist, start, &router->nodlist) {
+        if (start->implement == mir_device) {
+#if 0
+            if (start->direction == mir_output)
+                continue;       /* we should never get here */
+            if (!start->mux && !start->loop)
+                continue;       /* skip not looped back input nodes */
+#endif
+            if (!start->loop)
+                continue;       /* only looped back devices routed here */
+        }
+
+        if (start->stamp >= stamp)
+            continue;
+
+        if (!stream_is_dirty(u, start)) {
+            if ((end = keep_default_route(u, start, stamp)))
+                plan_add(router, start, end);
+            router->stats.kept++;
+            continue;
+        }
+
+        router->stats.touched++;
+
+        end = find_default_route(u, start, stamp);
+
+        /*
+         * moving away from a device or to a new one might change the
+         * constraints of the lower priority streams: the ones blocked
+         * from the old device might get back there
+         */
+        if (!end || end->index != start->rtarget) {
+            if ((prev = mir_node_find_by_index(u, start->rtarget)))
+                mark_node_dirty(u, prev);
+            if (end)
+                mark_node_dirty(u, end);
+        }
+
+        if (!end)
+            start->rtarget = PA_IDXSET_INVALID;
+        else {
+            start->rtarget = end->index;
+            plan_add(router, start, end);
+        }
+    }
+
+    /* applying: only the links that differ from the last pass are set up */
+    apply_plan(u, stamp);
+
+    total = router->stats.touched + router->stats.kept;
+
+    pa_log_debug("routing pass %u: %u of %u streams touched, %u links set "
+                 "up, %u unchanged (%u of %u requests coalesced)",
+                 router->stats.passes, router->stats.touched, total,
+                 router->stats.linked, router->stats.unchanged,
+                 router->stats.saved, router->stats.requests);
+
+    mir_volume_expire_limiting_classes(u, stamp);
+    pa_fader_apply_volume_limits(u, stamp);
+
+    if (router->trans.event) {
+        latency = pa_rtclock_now() - router->trans.event;
+        router->trans.event = 0;
+
+        router->stats.events++;
+        router->stats.latency = latency;
+        router->stats.totlatency += latency;
+        if (latency > router->stats.maxlatency)
+            router->stats.maxlatency = latency;
+
+        pa_log_debug("device event routed in %llu usec (max %llu usec)",
+                     (unsigned long long)latency,
+                     (unsigned long long)router->stats.maxlatency);
+    }
+
+    router->trans.ongoing = false;
+
+    if (router->trans.requested == router->trans.served)
+        clear_dirty(u);
+    else {
+        /* keep the dirty set; it has the marks of the nested requests */
+        pa_log_debug("routing was requested during the pass. "
+                     "Running it again in the next iteration");
+        u->core->mainloop->defer_enable(router->trans.defer, 1);
+    }
 }
 
 static void make_explicit_routes(struct userdata *u, uint32_t stamp)
@@ -793,25 +1763,57 @@ static void make_explicit_routes(struct userdata *u, uint32_t stamp)
         if (conn->blocked)
             continue;
 
-        if (!(from = mir_node_find_by_index(u, conn->from)) ||
-            !(to   = mir_node_find_by_index(u, conn->to))     )
-        {
+        if (!(from = conn->fromnode) || !(to = conn->tonode)) {
             pa_log_debug("ignoring explicit route %u: some of the nodes "
                          "not found", conn->amid);
             continue;
         }
 
-        if (!mir_switch_setup_link(u, from, to, true))
-            continue;
+        /* the link is set up only if it is new or one of its endpoints
+           has changed since the last time it was set up */
+        if (!conn->applied) {
+            if (!mir_switch_setup_link(u, from, to, true))
+                continue;
 
-        if (from->implement == mir_stream)
+            conn->applied = stamp;
+            pa_fader_mark_device_dirty(u, to);
+        }
+
+        if (from->implement == mir_stream) {
             from->stamp = stamp;
+            from->rtarget = PA_IDXSET_INVALID;
+            from->rtlink = PA_IDXSET_INVALID;
+        }
 
         if (to->implement == mir_device)
             mir_volume_add_limiting_class(u, to, volume_class(from), stamp);
     }
 }
 
+static void connection_unlink_nodes(mir_connection *conn)
+{
+    pa_assert(conn);
+
+    MIR_DLIST_UNLINK(mir_connection, fromchain, conn);
+    MIR_DLIST_UNLINK(mir_connection, tochain, conn);
+
+    conn->fromnode = NULL;
+    conn->tonode = NULL;
+}
+
+static void invalidate_connections(mir_node *node)
+{
+    mir_connection *conn;
+
+    pa_assert(node);
+
+    MIR_DLIST_FOR_EACH(mir_connection, fromchain, conn, &node->connfrom)
+        conn->applied = 0;
+
+    MIR_DLIST_FOR_EACH(mir_connection, tochain, conn, &node->connto)
+        conn->applied = 0;
+}
+
 
 static mir_node *find_default_route(struct userdata *u,
                                     mir_node        *start,
@@ -820,13 +1822,13 @@ static mir_node *find_default_route(struct userdata *u,
     pa_router     *router = u->router;
     mir_node_type  class  = pa_classify_guess_application_class(start);
     mir_zone      *zone   = pa_zoneset_get_zone_by_name(u, start->zone);
-    mir_rtgroup ***cmap;
-    mir_rtgroup  **zmap;
     mir_node      *end;
     mir_rtgroup   *rtg;
     mir_rtentry   *rte;
+    mir_direction  type;
+    size_t         pos;
 
-    if (class < 0 || class > router->maplen) {
+    if (class < 0 || class >= (int)router->maplen) {
         pa_log_debug("can't route '%s': class %d is out of range (0 - %d)",
                      start->amname, class, router->maplen);
         return NULL;
@@ -839,12 +1841,17 @@ static mir_node *find_default_route(struct userdata *u,
     }
 
     switch (start->direction) {
-    case mir_input:     cmap = router->classmap.output;     break;
-    case mir_output:    cmap = router->classmap.input;      break;
-    default:            cmap = NULL;                        break;
+    case mir_input:     type = mir_output;              break;
+    case mir_output:    type = mir_input;               break;
+    default:            type = mir_direction_unknown;   break;
     }
 
-    if (!cmap || !(zmap = cmap[zone->index]) || !(rtg = zmap[class])) {
+    if (type != mir_direction_unknown)
+        rtg = *classmap_entry(router, zone->index, type, class);
+    else
+        rtg = NULL;
+
+    if (!rtg) {
         pa_log_debug("node '%s' won't be routed beacuse its class '%s' "
                      "is not assigned to any router group",
                      start->amname, mir_node_type_str(class));
@@ -855,52 +1862,126 @@ static mir_node *find_default_route(struct userdata *u,
                  rtg->name, start->amname);
 
 
-    MIR_DLIST_FOR_EACH_BACKWARD(mir_rtentry, link, rte, &rtg->entries) {
-        if (!(end = rte->node)) {
-            pa_log("   node was null in mir_rtentry");
-            continue;
-        }
-
-        if (end->ignore) {
-            pa_log_debug("   '%s' ignored. Skipping...",end->amname);
-            continue;
-        }
-
-        if (!end->available) {
-            pa_log_debug("   '%s' not available. Skipping...", end->amname);
-            continue;
-        }
-
-        if (end->paidx == PA_IDXSET_INVALID && !end->paport) {
-            /* requires profile change. We do it only for BT headsets */
-            if (end->type != mir_bluetooth_a2dp &&
-                end->type != mir_bluetooth_sco    )
-            {
-                pa_log_debug("   '%s' has no sink. Skipping...", end->amname);
-                continue;
-            }
-        }
+    /* the index is in ascending order; the best candidate is the last one */
+    for (pos = rtgroup_last_routable(rtg, rtg->nentry);
+         pos < rtg->nentry;
+         pos = rtgroup_last_routable(rtg, pos))
+    {
+        rte = rtg->index[pos];
+        end = rte->node;
 
         if (rte->stamp < stamp)
             mir_constrain_apply(u, end, stamp);
         else {
             if (rte->blocked) {
-                pa_log_debug("   '%s' is blocked by constraints. Skipping...",
-                             end->amname);
+                mir_trace(u, mir_trace_router, mir_trace_route_blocked, stamp,
+                          end->index, start->type, 0, start->index);
                 continue;
             }
         }
 
-        pa_log_debug("routing '%s' => '%s'", start->amname, end->amname);
+        mir_trace(u, mir_trace_router, mir_trace_route_found, stamp,
+                  end->index, start->type, 0, start->index);
 
         return end;
     }
 
-    pa_log_debug("could not find route for '%s'", start->amname);
+    mir_trace(u, mir_trace_router, mir_trace_route_none, stamp,
+              PA_IDXSET_INVALID, start->type, 0, start->index);
 
     return NULL;
 }
 
+static mir_node *keep_default_route(struct userdata *u,
+                                    mir_node        *start,
+                                    uint32_t         stamp)
+{
+    mir_node    *end;
+    mir_rtentry *rte;
+
+    if (!(end = mir_node_find_by_index(u, start->rtarget))) {
+        start->rtarget = PA_IDXSET_INVALID;
+        return NULL;
+    }
+
+    /* re-apply the constraints the route would have applied */
+    MIR_DLIST_FOR_EACH(mir_rtentry, nodchain, rte, &end->rtentries) {
+        if (rte->stamp < stamp) {
+            mir_constrain_apply(u, end, stamp);
+            break;
+        }
+    }
+
+    return end;
+}
+
+static void plan_add(pa_router *router, mir_node *start, mir_node *end)
+{
+    pa_router_plan *plan = &router->plan;
+    mir_rtplan_entry *entry;
+
+    if (plan->nentry >= plan->maxentry) {
+        plan->maxentry += PLAN_BUCKET;
+        plan->entries = pa_xrealloc(plan->entries,
+                                    sizeof(mir_rtplan_entry) * plan->maxentry);
+    }
+
+    entry = plan->entries + plan->nentry++;
+    entry->stream = start;
+    entry->target = end;
+}
+
+static void apply_plan(struct userdata *u, uint32_t stamp)
+{
+    pa_router *router = u->router;
+    mir_rtplan_entry *entry;
+    size_t i;
+
+    for (i = 0;  i < router->plan.nentry;  i++) {
+        entry = router->plan.entries + i;
+        implement_default_route(u, entry->stream, entry->target, stamp);
+    }
+}
+
+static bool preroute_is_local(struct userdata *u, mir_node *data, int priority)
+{
+    pa_router *router = u->router;
+    mir_node *start;
+
+    /* only the input streams are ordered by their priority */
+    if (data->direction != mir_input)
+        return true;
+
+    /*
+     * nodlist is in ascending priority order; the first node of the zone
+     * has the lowest priority of the routed nodes there. A new stream of
+     * the same priority goes ahead of its peers and can displace them.
+     */
+    MIR_DLIST_FOR_EACH(mir_node, rtprilist, start, &router->nodlist) {
+        if (start->implement == mir_device && !start->loop)
+            continue;
+
+        if (!start->zone || !data->zone || strcmp(start->zone, data->zone))
+            continue;
+
+        return priority < node_priority(u, start);
+    }
+
+    return true;
+}
+
+static void forget_links(struct userdata *u, mir_node *node)
+{
+    pa_router *router = u->router;
+    mir_node *start;
+
+    /* the device has changed; the links leading to it must be set up again */
+    MIR_DLIST_FOR_EACH(mir_node, rtprilist, start, &router->nodlist) {
+        if (start->rtlink == node->index)
+            start->rtlink = PA_IDXSET_INVALID;
+    }
+}
+
 static void implement_preroute(struct userdata *u,
                                mir_node        *data,
                                mir_node        *target,
@@ -919,12 +2000,35 @@ static void implement_default_route(struct userdata *u,
                                     mir_node        *end,
                                     uint32_t         stamp)
 {
-    if (start->direction == mir_output)
-        mir_switch_setup_link(u, end, start, false);
+    pa_router *router = u->router;
+    mir_node *prev;
+    bool linked;
+
+    start->rtarget = end->index;
+
+    /*
+     * a port node whose sink or source was switched to another port lost
+     * its paidx; the link must be set up again to switch the port back
+     */
+    if (start->rtlink == end->index && end->paidx != PA_IDXSET_INVALID)
+        router->stats.unchanged++;
     else {
-        mir_switch_setup_link(u, start, end, false);
-        mir_volume_add_limiting_class(u, end, volume_class(start), stamp);
+        /* both the old and the new device need their limits revisited */
+        if ((prev = mir_node_find_by_index(u, start->rtlink)))
+            pa_fader_mark_device_dirty(u, prev);
+        pa_fader_mark_device_dirty(u, end);
+
+        if (start->direction == mir_output)
+            linked = mir_switch_setup_link(u, end, start, false);
+        else
+            linked = mir_switch_setup_link(u, start, end, false);
+
+        start->rtlink = linked ? end->index : PA_IDXSET_INVALID;
+        router->stats.linked++;
     }
+
+    if (start->direction == mir_input)
+        mir_volume_add_limiting_class(u, end, volume_class(start), stamp);
 }
 
 
@@ -978,6 +2082,38 @@ static int volume_class(mir_node *node)
 }
 
 
+int mir_router_print_plan(struct userdata *u, char *buf, int len)
+{
+    pa_router *router;
+    mir_rtplan_entry *entry;
+    char *p, *e;
+    size_t i;
+
+    pa_assert(u);
+    pa_assert(buf);
+    pa_assert(len > 0);
+    pa_assert_se((router = u->router));
+
+    e = (p = buf) + len;
+
+    p += snprintf(p, (size_t)(e-p), "routing plan of pass %u:\n",
+                  router->plan.stamp);
+
+    for (i = 0;  i < router->plan.nentry && p < e;  i++) {
+        entry = router->plan.entries + i;
+
+        p += snprintf(p, (size_t)(e-p), "   '%s' => '%s'%s\n",
+                      entry->stream->amname, entry->target->amname,
+                      entry->stream->rtlink == entry->target->index ?
+                      "" : " (not linked)");
+    }
+
+    if (!router->plan.nentry && p < e)
+        p += snprintf(p, (size_t)(e-p), "   <empty>\n");
+
+    return p - buf;
+}
+
 static int print_routing_table(pa_hashmap  *table,
                                const char  *type,
                                char        *buf,
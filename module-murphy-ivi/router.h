@@ -32,6 +32,8 @@ typedef bool (*mir_rtgroup_accept_t)(struct userdata *, mir_rtgroup *,
                                           mir_node *);
 typedef int       (*mir_rtgroup_compare_t)(struct userdata *, mir_rtgroup *,
                                            mir_node *, mir_node *);
+typedef uint32_t  (*mir_rtgroup_key_t)(struct userdata *, mir_rtgroup *,
+                                       mir_node *);
 
 typedef struct {
     pa_hashmap *input;
@@ -39,18 +41,67 @@ typedef struct {
 } pa_rtgroup_hash;
 
 typedef struct {
-    mir_rtgroup **input[MRP_ZONE_MAX];
-    mir_rtgroup **output[MRP_ZONE_MAX];
-} pa_rtgroup_classmap;
+    bool      all;                  /**< reroute every stream */
+    uint32_t  input[MRP_ZONE_MAX];  /**< dirty class bits of input rtgroups */
+    uint32_t  output[MRP_ZONE_MAX]; /**< dirty class bits of output rtgroups */
+} pa_rtgroup_dirtyset;
+
+typedef struct {
+    mir_node  *stream;  /**< stream or looped back device node */
+    mir_node  *target;  /**< device node where the default route leads to */
+} mir_rtplan_entry;
+
+typedef struct {
+    uint32_t          stamp;    /**< stamp of the pass that made the plan */
+    size_t            nentry;
+    size_t            maxentry;
+    mir_rtplan_entry *entries;  /**< default routes in priority order */
+} pa_router_plan;
+
+typedef struct {
+    uint32_t  passes;   /**< number of routing passes */
+    uint32_t  touched;  /**< stream nodes rerouted in the last pass */
+    uint32_t  kept;     /**< stream nodes left on their route in the last pass*/
+    uint32_t  requests; /**< number of routing requests */
+    uint32_t  saved;    /**< requests coalesced into another pass */
+    uint32_t  linked;   /**< links set up in the last pass */
+    uint32_t  unchanged;/**< planned links already in place in the last pass*/
+    uint32_t  preroutes;/**< number of pre-routed new streams */
+    uint32_t  shortcuts;/**< pre-routings that left the other streams alone */
+    uint32_t  events;   /**< device events that were routed */
+    pa_usec_t latency;  /**< device event to end of routing in the last
+                             pass that routed an event */
+    pa_usec_t maxlatency;
+    pa_usec_t totlatency;
+    uint32_t  held;     /**< device nodes registered in bulk */
+    uint32_t  bulks;    /**< number of bulk registrations */
+} pa_router_stats;
+
+typedef struct {
+    pa_defer_event *defer;     /**< runs the pending routing pass */
+    uint32_t        requested; /**< generation of the latest request */
+    uint32_t        served;    /**< generation the last pass was started for */
+    bool            ongoing;   /**< a routing pass is in progress */
+    pa_usec_t       event;     /**< time of the oldest device event not
+                                    routed yet or 0 */
+    uint32_t        hold;      /**< nesting depth of routing holds */
+    pa_idxset      *held;      /**< device nodes waiting for the release
+                                    of the hold to be registered */
+} pa_router_transaction;
 
 struct pa_router {
     pa_rtgroup_hash      rtgroups;
     size_t               maplen;   /**< length of the class- and priormap */
-    pa_rtgroup_classmap  classmap; /**< to map device node types to rtgroups */
+    mir_rtgroup        **classmap; /**< rtgroups by [zone][direction][class] */
     int                 *priormap; /**< stream node priorities */
     mir_dlist            nodlist;  /**< priorized list of the stream nodes
                                         (entry in node: rtprilist) */
     mir_dlist            connlist; /**< listhead of the connections */
+    pa_rtgroup_dirtyset  dirty;    /**< zone/class pairs needing rerouting */
+    pa_router_transaction trans;   /**< routing requests of this iteration */
+    pa_defer_event      *propdefer;/**< updates the routing.table properties */
+    pa_router_plan       plan;     /**< default routes of the last pass */
+    pa_router_stats      stats;
 };
 
 
@@ -61,22 +112,38 @@ struct mir_rtentry {
     mir_node    *node;        /**< pointer to the owning node */
     bool         blocked;     /**< weather this routing entry is active */
     uint32_t     stamp;
+    uint32_t     key;         /**< sort key, if the rtgroup has key function*/
 };
 
 struct mir_rtgroup {
     char                  *name;      /**< name of the rtgroup */
+    mir_direction          type;      /**< input or output */
+    bool                   propdirty; /**< module property needs an update */
     mir_dlist              entries;   /**< listhead of ordered rtentries */
+    mir_rtentry          **index;     /**< rtentries in the same order */
+    uint32_t              *routable;  /**< bitmask of the entries in index
+                                           that are currently routable */
+    size_t                 nentry;    /**< number of entries in the index */
+    size_t                 maxentry;  /**< allocated length of the index */
     mir_rtgroup_accept_t   accept;    /**< wheter to accept a node or not */
     mir_rtgroup_compare_t  compare;   /**< comparision function for ordering */
+    mir_rtgroup_key_t      key;       /**< sort key function of compare, or
+                                           NULL if there is none */
     scripting_rtgroup     *scripting; /**< data for scripting, if any */
 };
 
 struct mir_connection {
     mir_dlist     link;     /**< list of connections */
+    mir_dlist     fromchain;/**< chain of connections of the source node */
+    mir_dlist     tochain;  /**< chain of connections of the destination node*/
     bool     blocked;  /**< true if this conflicts with another route */
     uint16_t      amid;     /**< audio manager connection id */
     uint32_t      from;     /**< source node index */
     uint32_t      to;       /**< destination node index */
+    mir_node     *fromnode; /**< source node or NULL if it is gone */
+    mir_node     *tonode;   /**< destination node or NULL if it is gone */
+    uint32_t      applied;  /**< stamp of the pass that set up the link;
+                                 zero if it needs to be (re)set up */
     uint32_t      stream;   /**< index of the sink-input to be routed */
 };
 
@@ -99,8 +166,17 @@ bool mir_router_assign_class_to_rtgroup(struct userdata *, mir_node_type,
 void mir_router_register_node(struct userdata *, mir_node *);
 void mir_router_unregister_node(struct userdata *, mir_node *);
 
+void mir_router_mark_node_dirty(struct userdata *, mir_node *);
+void mir_router_stream_moved(struct userdata *, mir_node *, uint32_t);
+void mir_router_mark_all_dirty(struct userdata *);
+
 mir_node *mir_router_make_prerouting(struct userdata *, mir_node *);
 void mir_router_make_routing(struct userdata *);
+void mir_router_make_incremental_routing(struct userdata *);
+void mir_router_flush_routing(struct userdata *);
+
+void mir_router_hold_routing(struct userdata *);
+bool mir_router_release_routing(struct userdata *);
 
 mir_connection *mir_router_add_explicit_route(struct userdata *, uint16_t,
                                               mir_node *, mir_node *);
@@ -108,6 +184,9 @@ void mir_router_remove_explicit_route(struct userdata *, mir_connection *);
 
 
 int mir_router_print_rtgroups(struct userdata *, char *, int);
+int mir_router_print_plan(struct userdata *, char *, int);
+
+void mir_router_note_device_event(struct userdata *, pa_usec_t);
 
 bool mir_router_default_accept(struct userdata *, mir_rtgroup *,
                                     mir_node *);
@@ -119,6 +198,9 @@ int mir_router_default_compare(struct userdata *, mir_rtgroup *,
 int mir_router_phone_compare(struct userdata *, mir_rtgroup *,
                              mir_node *, mir_node *);
 
+uint32_t mir_router_default_key(struct userdata *, mir_rtgroup *, mir_node *);
+uint32_t mir_router_phone_key(struct userdata *, mir_rtgroup *, mir_node *);
+
 
 #endif  /* foomirrouterfoo */
 
@@ -1375,6 +1375,7 @@ static int rtgroup_create(lua_State *L)
     mir_direction type = 0;
     mrp_funcbridge_t *accept = NULL;
     mrp_funcbridge_t *compare = NULL;
+    mir_rtgroup_compare_t cmpfn;
     char id[256];
 
     MRP_LUA_ENTER;
@@ -1410,8 +1411,20 @@ static int rtgroup_create(lua_State *L)
 
     rtgs = (scripting_rtgroup *)mrp_lua_create_object(L, RTGROUP_CLASS, id,0);
 
+    /*
+     * builtin compare functions are called directly, bypassing Lua.
+     * This lets the router order the entries by a precomputed key.
+     */
+    cmpfn = rtgroup_compare;
+
+    if (compare->type == MRP_C_FUNCTION) {
+        if (compare->c.data == mir_router_default_compare ||
+            compare->c.data == mir_router_phone_compare     )
+            cmpfn = (mir_rtgroup_compare_t)compare->c.data;
+    }
+
     rtg  = mir_router_create_rtgroup(u, type, pa_xstrdup(name),
-                                     rtgroup_accept, rtgroup_compare);
+                                     rtgroup_accept, cmpfn);
     if (!rtgs || !rtg)
         luaL_error(L, "failed to create routing group '%s'", id);
 
@@ -2090,6 +2103,7 @@ static int vollim_create(lua_State *L)
     intarray_t *classes = NULL;
     bool suppress = false;
     bool correct = false;
+    mir_volume_func_t func = vollim_calculate;
     size_t arglgh = 0;
     int i;
     int class;
@@ -2133,6 +2147,13 @@ static int vollim_create(lua_State *L)
         if (calculate->type == MRP_C_FUNCTION) {
             if (strcmp(calculate->c.signature, "odod"))
                 luaL_error(L,"invalid calculate field (mismatching signature)");
+
+            /*
+             * the builtin methods get their arguments from the limit
+             * definition; call them directly, bypassing the interpreter
+             */
+            func = (mir_volume_func_t)calculate->c.data;
+
             if (calculate->c.data == mir_volume_suppress) {
                 if (type != vollim_class)
                     luaL_error(L, "attempt to make generic volume supression");
@@ -2230,14 +2251,16 @@ static int vollim_create(lua_State *L)
         memcpy(vlim->args, &limit->value, sizeof(limit->value));
     }
 
+    pa_log_debug("volume limit '%s' is %s", name,
+                 func == vollim_calculate ? "a script function" : "builtin");
+
     switch (type) {
     case vollim_generic:
-        mir_volume_add_generic_limit(u, vollim_calculate, vlim->args);
+        mir_volume_add_generic_limit(u, func, vlim->args);
         break;
     case vollim_class:
         for (i = 0;  i < (int)(classes->nint);  i++) {
-            mir_volume_add_class_limit(u, classes->ints[i], vollim_calculate,
-                                       vlim->args);
+            mir_volume_add_class_limit(u, classes->ints[i], func, vlim->args);
         }
         break;
     case vollim_maximum:
@@ -0,0 +1,244 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include <pulsecore/pulsecore-config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim-shim.h"
+#include "node.h"
+#include "router.h"
+#include "switch.h"
+#include "fader.h"
+#include "volume.h"
+#include "multiplex.h"
+#include "loopback.h"
+#include "murphyif.h"
+
+static FILE           *output;
+static sim_shim_stats  stats;
+
+
+void sim_shim_set_output(FILE *f)
+{
+    output = f;
+}
+
+void sim_shim_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+sim_shim_stats *sim_shim_get_stats(void)
+{
+    return &stats;
+}
+
+
+bool mir_switch_setup_link(struct userdata *u,
+                           mir_node *from,
+                           mir_node *to,
+                           bool explicit)
+{
+    pa_assert(u);
+    pa_assert(from || to);
+
+    stats.links++;
+
+    if (output) {
+        fprintf(output, "   %s route '%s' => '%s'\n",
+                explicit ? "explicit" : "default",
+                from ? from->amname : "<new stream>",
+                to ? to->amname : "<new stream>");
+    }
+
+    return true;
+}
+
+bool mir_switch_teardown_link(struct userdata *u, mir_node *from, mir_node *to)
+{
+    pa_assert(u);
+    pa_assert(from);
+    pa_assert(to);
+
+    stats.teardowns++;
+
+    if (output)
+        fprintf(output, "   teardown '%s' => '%s'\n", from->amname, to->amname);
+
+    return true;
+}
+
+
+void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
+{
+    mir_node *node;
+    mir_node *sink;
+    mir_node *n;
+    uint32_t  idx, i;
+    uint32_t  mask;
+    double    dB;
+
+    pa_assert(u);
+
+    if (!output)
+        return;
+
+    mir_volume_forget_limits(u);
+
+    /* same as the real fader, but on the routes the router remembers */
+    idx = PA_IDXSET_INVALID;
+
+    while ((node = pa_nodeset_iterate_nodes(u, &idx))) {
+        if (node->implement != mir_stream || node->direction != mir_input)
+            continue;
+
+        if (!(sink = mir_node_find_by_index(u, node->rtarget)))
+            continue;
+
+        mask = 0;
+        i = PA_IDXSET_INVALID;
+
+        while ((n = pa_nodeset_iterate_nodes(u, &i))) {
+            if (n->implement == mir_stream && n->rtarget == sink->index)
+                mask |= mir_volume_get_class_mask(n->type);
+        }
+
+        dB = mir_volume_apply_limits(u, sink, mask, node->type, stamp);
+
+        if (dB < 0.0) {
+            fprintf(output, "   limit '%s' on '%s' to %.1lf dB\n",
+                    node->amname, sink->amname, dB);
+        }
+    }
+}
+
+void pa_fader_mark_device_dirty(struct userdata *u, mir_node *node)
+{
+    (void)u;
+    (void)node;
+}
+
+void pa_fader_mark_zone_dirty(struct userdata *u, const char *zone)
+{
+    (void)u;
+    (void)zone;
+}
+
+void pa_fader_mark_all_dirty(struct userdata *u)
+{
+    (void)u;
+}
+
+
+pa_muxnode *pa_multiplex_find_by_module(pa_multiplex *multiplex,
+                                        pa_module *module)
+{
+    (void)multiplex;
+    (void)module;
+
+    return NULL;
+}
+
+int pa_multiplex_print(pa_muxnode *mux, char *buf, int len)
+{
+    (void)mux;
+
+    if (len > 0)
+        *buf = 0;
+
+    return 0;
+}
+
+int pa_loopback_print(pa_loopnode *loop, char *buf, int len)
+{
+    (void)loop;
+
+    if (len > 0)
+        *buf = 0;
+
+    return 0;
+}
+
+
+int pa_murphyif_add_watch(struct userdata *u,
+                          const char *table,
+                          const char *columns,
+                          const char *where,
+                          int max_rows)
+{
+    (void)u;
+    (void)table;
+    (void)columns;
+    (void)where;
+    (void)max_rows;
+
+    return 0;
+}
+
+void pa_murphyif_setup_domainctl(struct userdata *u, pa_murphyif_watch_cb cb)
+{
+    (void)u;
+    (void)cb;
+}
+
+void pa_murphyif_add_audio_resource(struct userdata *u,
+                                    mir_direction type,
+                                    const char *name)
+{
+    (void)u;
+    (void)type;
+    (void)name;
+}
+
+void pa_murphyif_add_audio_attribute(struct userdata *u,
+                                     const char *propnam,
+                                     const char *attrnam,
+                                     mqi_data_type_t type,
+                                     ... )
+{
+    (void)u;
+    (void)propnam;
+    (void)attrnam;
+    (void)type;
+}
+
+void pa_murphyif_destroy_resource_set(struct userdata *u, mir_node *node)
+{
+    (void)u;
+    (void)node;
+}
+
+void pa_murphyif_delete_node(struct userdata *u, mir_node *node)
+{
+    (void)u;
+    (void)node;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
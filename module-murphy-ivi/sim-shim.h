@@ -0,0 +1,53 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+#ifndef foomirsimshimfoo
+#define foomirsimshimfoo
+
+/*
+ * Stand-ins for the parts of the module that the policy core calls but
+ * which would need a live audio system (switch, fader, multiplex,
+ * loopback and the murphy interface). Instead of touching sinks and
+ * streams they print the decisions of the policy core.
+ */
+
+#include <stdio.h>
+
+#include "userdata.h"
+
+typedef struct {
+    uint32_t  links;     /**< links set up in the current pass */
+    uint32_t  teardowns; /**< links torn down in the current pass */
+} sim_shim_stats;
+
+void sim_shim_set_output(FILE *);
+void sim_shim_reset_stats(void);
+sim_shim_stats *sim_shim_get_stats(void);
+
+
+#endif  /* foomirsimshimfoo */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# run-sim-test.sh -- replays a scenario with mir-route-sim and checks that
+# the lines given in the scenario as '# expect: <text>' appear in the
+# output in the given order. The text is matched as a fixed string.
+#
+# usage: run-sim-test.sh scenario.sim
+#
+# MIR_ROUTE_SIM overrides the simulator, ./mir-route-sim by default.
+#
+
+sim=${MIR_ROUTE_SIM:-./mir-route-sim}
+scenario=$1
+
+if [ -z "$scenario" ] || [ ! -r "$scenario" ]; then
+    echo "usage: $0 scenario.sim" >&2
+    exit 2
+fi
+
+out=$(mktemp) || exit 2
+trap 'rm -f "$out"' EXIT
+
+if ! "$sim" "$scenario" > "$out" 2>&1; then
+    cat "$out"
+    echo "FAIL: $sim exited with an error" >&2
+    exit 1
+fi
+
+sed -n 's/^# expect: //p' "$scenario" | {
+    pos=0
+
+    while IFS= read -r expect; do
+        n=$(tail -n +$((pos + 1)) "$out" | grep -n -F -m 1 -- "$expect" |
+            cut -d: -f1)
+
+        if [ -z "$n" ]; then
+            cat "$out"
+            echo "FAIL: '$expect' not found after line $pos" >&2
+            exit 1
+        fi
+
+        pos=$((pos + n))
+    done
+}
@@ -99,6 +99,8 @@ void pa_stream_state_change(struct userdata *u, mir_node *node, int req)
                 pa_assert_not_reached();
                 break;
             }
+
+            pa_fader_update_stream(u, sinp);
         }
         else {
             pa_log_debug("no enforcement for loopback on '%s'", node->amname);
@@ -132,6 +134,10 @@ void pa_stream_state_change(struct userdata *u, mir_node *node, int req)
                 pa_assert_not_reached();
                 break;
             }
+
+            /* a killed stream is forgotten when it gets unlinked */
+            if (req != PA_STREAM_KILL)
+                pa_fader_update_stream(u, sinp);
         }
         else {
             pa_log_debug("no enforcement for stream '%s'", node->amname);
@@ -0,0 +1,329 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include <pulsecore/pulsecore-config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-rtclock.h>
+
+#include "trace.h"
+
+typedef struct {
+    uint32_t  magic;
+    uint32_t  version;
+    uint32_t  recsize;   /**< sizeof(mir_trace_record) of the writer */
+    uint32_t  nring;
+} dump_header;
+
+typedef struct {
+    uint32_t  subsys;
+    uint32_t  nrecord;   /**< records following, oldest first */
+} dump_ring;
+
+static const char *subsys_names[mir_trace_subsys_max] = {
+    [mir_trace_router]    = "router",
+    [mir_trace_constrain] = "constrain",
+    [mir_trace_volume]    = "volume",
+    [mir_trace_fader]     = "fader",
+};
+
+static const char *event_names[mir_trace_event_max] = {
+    [mir_trace_event_unknown]   = "unknown",
+    [mir_trace_route_blocked]   = "route-blocked",
+    [mir_trace_route_found]     = "route-found",
+    [mir_trace_route_none]      = "route-none",
+    [mir_trace_constrain_block] = "constrain-block",
+    [mir_trace_volume_suppress] = "volume-suppress",
+    [mir_trace_volume_device]   = "volume-device",
+    [mir_trace_volume_class]    = "volume-class",
+    [mir_trace_fader_sink]      = "fader-sink",
+    [mir_trace_fader_skip]      = "fader-skip",
+    [mir_trace_fader_stream]    = "fader-stream",
+};
+
+static int parse_subsystems(const char *, uint32_t *);
+static uint32_t ring_count(mir_trace_ring *);
+
+
+pa_trace *pa_trace_init(struct userdata *u, const char *subsystems)
+{
+    pa_trace *trace;
+
+    pa_assert(u);
+
+    trace = pa_xnew0(pa_trace, 1);
+
+    u->trace = trace;
+
+    if (subsystems && pa_trace_enable(u, subsystems) < 0)
+        pa_log("invalid trace subsystems '%s'", subsystems);
+
+    return trace;
+}
+
+void pa_trace_done(struct userdata *u)
+{
+    pa_trace *trace;
+    int i;
+
+    if (u && (trace = u->trace)) {
+        for (i = 0;  i < mir_trace_subsys_max;  i++)
+            pa_xfree(trace->rings[i].records);
+
+        pa_xfree(trace);
+
+        u->trace = NULL;
+    }
+}
+
+int pa_trace_enable(struct userdata *u, const char *subsystems)
+{
+    pa_trace *trace;
+    mir_trace_ring *ring;
+    uint32_t mask;
+    int i;
+
+    pa_assert(u);
+    pa_assert_se((trace = u->trace));
+
+    if (parse_subsystems(subsystems, &mask) < 0)
+        return -1;
+
+    for (i = 0;  i < mir_trace_subsys_max;  i++) {
+        ring = trace->rings + i;
+
+        if ((mask & (1U << i)) && !ring->records)
+            ring->records = pa_xnew0(mir_trace_record, MIR_TRACE_RING_SIZE);
+    }
+
+    trace->mask = mask;
+
+    pa_log_info("tracing mask set to 0x%x", mask);
+
+    return 0;
+}
+
+uint32_t pa_trace_get_mask(struct userdata *u)
+{
+    pa_assert(u);
+
+    return u->trace ? u->trace->mask : 0;
+}
+
+void mir_trace_add(pa_trace        *trace,
+                   mir_trace_subsys subsys,
+                   mir_trace_event  event,
+                   uint32_t         stamp,
+                   uint32_t         node,
+                   int              class,
+                   int32_t          value,
+                   uint32_t         arg)
+{
+    mir_trace_ring *ring;
+    mir_trace_record *rec;
+
+    pa_assert(trace);
+    pa_assert(subsys < mir_trace_subsys_max);
+
+    ring = trace->rings + subsys;
+
+    pa_assert(ring->records);
+
+    rec = ring->records + (ring->head++ & (MIR_TRACE_RING_SIZE - 1));
+
+    rec->time  = pa_rtclock_now();
+    rec->stamp = stamp;
+    rec->node  = node;
+    rec->arg   = arg;
+    rec->value = value;
+    rec->event = event;
+    rec->class = class;
+}
+
+void *pa_trace_dump(struct userdata *u, size_t *size)
+{
+    pa_trace *trace;
+    mir_trace_ring *ring;
+    dump_header *hdr;
+    dump_ring *dr;
+    mir_trace_record *rec;
+    uint32_t n, nring, first, j;
+    size_t len;
+    char *buf, *p;
+    int i;
+
+    pa_assert(u);
+    pa_assert(size);
+    pa_assert_se((trace = u->trace));
+
+    len = sizeof(dump_header);
+    nring = 0;
+
+    for (i = 0;  i < mir_trace_subsys_max;  i++) {
+        if ((n = ring_count(trace->rings + i)) > 0) {
+            len += sizeof(dump_ring) + n * sizeof(mir_trace_record);
+            nring++;
+        }
+    }
+
+    buf = pa_xmalloc0(len);
+
+    hdr = (dump_header *)buf;
+    hdr->magic   = MIR_TRACE_MAGIC;
+    hdr->version = MIR_TRACE_VERSION;
+    hdr->recsize = sizeof(mir_trace_record);
+    hdr->nring   = nring;
+
+    p = buf + sizeof(dump_header);
+
+    for (i = 0;  i < mir_trace_subsys_max;  i++) {
+        ring = trace->rings + i;
+
+        if (!(n = ring_count(ring)))
+            continue;
+
+        dr = (dump_ring *)p;
+        dr->subsys  = i;
+        dr->nrecord = n;
+
+        rec = (mir_trace_record *)(p + sizeof(dump_ring));
+        first = ring->head - n;
+
+        for (j = 0;  j < n;  j++)
+            rec[j] = ring->records[(first + j) & (MIR_TRACE_RING_SIZE - 1)];
+
+        p += sizeof(dump_ring) + n * sizeof(mir_trace_record);
+    }
+
+    *size = len;
+
+    return buf;
+}
+
+int mir_trace_decode(const void *buf, size_t size, FILE *f)
+{
+    const dump_header *hdr;
+    const dump_ring *dr;
+    const mir_trace_record *rec;
+    const char *p, *e, *ev;
+    uint32_t i, j;
+
+    pa_assert(buf);
+    pa_assert(f);
+
+    p = buf;
+    e = p + size;
+    hdr = buf;
+
+    if (size < sizeof(dump_header) || hdr->magic != MIR_TRACE_MAGIC ||
+        hdr->version != MIR_TRACE_VERSION ||
+        hdr->recsize != sizeof(mir_trace_record))
+    {
+        return -1;
+    }
+
+    p += sizeof(dump_header);
+
+    for (i = 0;  i < hdr->nring;  i++) {
+        if (p + sizeof(dump_ring) > e)
+            return -1;
+
+        dr = (const dump_ring *)p;
+        p += sizeof(dump_ring);
+
+        if (dr->subsys >= mir_trace_subsys_max ||
+            (size_t)(e - p) < dr->nrecord * sizeof(mir_trace_record))
+        {
+            return -1;
+        }
+
+        fprintf(f, "%s: %u records\n", subsys_names[dr->subsys], dr->nrecord);
+
+        for (j = 0;  j < dr->nrecord;  j++) {
+            rec = (const mir_trace_record *)p + j;
+
+            if (rec->event < mir_trace_event_max && event_names[rec->event])
+                ev = event_names[rec->event];
+            else
+                ev = "<invalid>";
+
+            fprintf(f, "   %llu stamp %u %-16s node %u class %d value %d "
+                    "arg 0x%x\n", (unsigned long long)rec->time, rec->stamp,
+                    ev, rec->node, rec->class, rec->value, rec->arg);
+        }
+
+        p += dr->nrecord * sizeof(mir_trace_record);
+    }
+
+    return 0;
+}
+
+
+static int parse_subsystems(const char *subsystems, uint32_t *mask_ret)
+{
+    const char *state = NULL;
+    char *name;
+    uint32_t mask = 0;
+    int i, ret = 0;
+
+    while ((name = pa_split(subsystems, ",", &state))) {
+        if (pa_streq(name, "all"))
+            mask = (1U << mir_trace_subsys_max) - 1;
+        else if (!pa_streq(name, "none")) {
+            for (i = 0;  i < mir_trace_subsys_max;  i++) {
+                if (pa_streq(name, subsys_names[i]))
+                    break;
+            }
+
+            if (i < mir_trace_subsys_max)
+                mask |= 1U << i;
+            else
+                ret = -1;
+        }
+
+        pa_xfree(name);
+    }
+
+    if (!ret)
+        *mask_ret = mask;
+
+    return ret;
+}
+
+static uint32_t ring_count(mir_trace_ring *ring)
+{
+    if (!ring->records)
+        return 0;
+
+    return ring->head < MIR_TRACE_RING_SIZE ? ring->head : MIR_TRACE_RING_SIZE;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -0,0 +1,125 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+#ifndef foomirtracefoo
+#define foomirtracefoo
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "userdata.h"
+
+/*
+ * Binary event tracing for the hot paths of the routing and volume
+ * policy. Every subsystem has its own ring of fixed size records that
+ * is allocated when the tracing of the subsystem is first enabled.
+ * While a subsystem is not traced mir_trace() costs a single test.
+ */
+
+#define MIR_TRACE_RING_SIZE  4096  /* records per subsystem; power of 2 */
+#define MIR_TRACE_MAGIC      0x5452494dU  /* 'MIRT' */
+#define MIR_TRACE_VERSION    1
+
+#define MIR_TRACE_DB(dB)     ((int32_t)((dB) * 100.0))
+
+typedef enum {
+    mir_trace_router = 0,
+    mir_trace_constrain,
+    mir_trace_volume,
+    mir_trace_fader,
+    mir_trace_subsys_max
+} mir_trace_subsys;
+
+typedef enum {
+    mir_trace_event_unknown = 0,
+
+    /* router; node: candidate device, arg: stream */
+    mir_trace_route_blocked,
+    mir_trace_route_found,
+    mir_trace_route_none,
+
+    /* constrain; node: blocked node, value: blocked or not */
+    mir_trace_constrain_block,
+
+    /* volume; node: device, value: 1/100 dB, arg: stream mask */
+    mir_trace_volume_suppress,
+    mir_trace_volume_device,
+    mir_trace_volume_class,
+
+    /* fader; node: sink or sink-input index */
+    mir_trace_fader_sink,       /* arg: class mask */
+    mir_trace_fader_skip,
+    mir_trace_fader_stream,     /* value: 1/100 dB, arg: transition ms */
+
+    mir_trace_event_max
+} mir_trace_event;
+
+typedef struct {
+    uint64_t  time;     /**< rtclock time of the event in usec */
+    uint32_t  stamp;    /**< routing/limiting stamp */
+    uint32_t  node;     /**< node or PA object index */
+    uint32_t  arg;      /**< event specific */
+    int32_t   value;    /**< event specific; dB values in 1/100 dB */
+    uint16_t  event;    /**< mir_trace_event */
+    int16_t   class;    /**< stream class, if any */
+    uint32_t  reserved;
+} mir_trace_record;
+
+typedef struct {
+    mir_trace_record *records;  /**< MIR_TRACE_RING_SIZE records or NULL */
+    uint32_t          head;     /**< number of records ever written */
+} mir_trace_ring;
+
+/* public so that mir_trace() can test the mask without a call */
+struct pa_trace {
+    uint32_t        mask;       /**< bits of the traced subsystems */
+    mir_trace_ring  rings[mir_trace_subsys_max];
+};
+
+#define mir_trace(u, subsys, event, stamp, node, class, value, arg)        \
+    do {                                                                \
+        if ((u)->trace && ((u)->trace->mask & (1U << (subsys))))        \
+            mir_trace_add((u)->trace, subsys, event, stamp, node,       \
+                          class, value, arg);                           \
+    } while (0)
+
+
+pa_trace *pa_trace_init(struct userdata *, const char *);
+void pa_trace_done(struct userdata *);
+
+int pa_trace_enable(struct userdata *, const char *);
+uint32_t pa_trace_get_mask(struct userdata *);
+
+void mir_trace_add(pa_trace *, mir_trace_subsys, mir_trace_event, uint32_t,
+                   uint32_t, int, int32_t, uint32_t);
+
+void *pa_trace_dump(struct userdata *, size_t *);
+int mir_trace_decode(const void *, size_t, FILE *);
+
+
+#endif  /* foomirtracefoo */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -29,6 +29,7 @@
 #include "utils.h"
 #include "discover.h"
 #include "router.h"
+#include "fader.h"
 #include "node.h"
 
 
@@ -46,6 +47,7 @@ struct pa_sink_hooks {
     pa_hook_slot    *put;
     pa_hook_slot    *unlink;
     pa_hook_slot    *portchg;
+    pa_hook_slot    *volchg;
 };
 
 struct pa_source_hooks {
@@ -58,12 +60,15 @@ struct pa_sink_input_hooks {
     pa_hook_slot    *neew;
     pa_hook_slot    *put;
     pa_hook_slot    *unlink;
+    pa_hook_slot    *mutechg;
+    pa_hook_slot    *moved;
 };
 
 struct pa_source_output_hooks {
     pa_hook_slot    *neew;
     pa_hook_slot    *put;
     pa_hook_slot    *unlink;
+    pa_hook_slot    *moved;
 };
 
 
@@ -86,6 +91,7 @@ static pa_hook_result_t port_available_changed(void *, void *, void *);
 static pa_hook_result_t sink_put(void *, void *, void *);
 static pa_hook_result_t sink_unlink(void *, void *, void *);
 static pa_hook_result_t sink_port_changed(void *, void *, void *);
+static pa_hook_result_t sink_volume_changed(void *, void *, void *);
 
 static pa_hook_result_t source_put(void *, void *, void *);
 static pa_hook_result_t source_unlink(void *, void *, void *);
@@ -94,10 +100,13 @@ static pa_hook_result_t source_port_changed(void *, void *, void *);
 static pa_hook_result_t sink_input_new(void *, void *, void *);
 static pa_hook_result_t sink_input_put(void *, void *, void *);
 static pa_hook_result_t sink_input_unlink(void *, void *, void *);
+static pa_hook_result_t sink_input_changed(void *, void *, void *);
+static pa_hook_result_t sink_input_moved(void *, void *, void *);
 
 static pa_hook_result_t source_output_new(void *, void *, void *);
 static pa_hook_result_t source_output_put(void *, void *, void *);
 static pa_hook_result_t source_output_unlink(void *, void *, void *);
+static pa_hook_result_t source_output_moved(void *, void *, void *);
 
 
 pa_tracker *pa_tracker_init(struct userdata *u)
@@ -155,6 +164,10 @@ pa_tracker *pa_tracker_init(struct userdata *u)
                         hooks + PA_CORE_HOOK_SINK_PORT_CHANGED,
                         PA_HOOK_LATE, sink_port_changed, u
                     );
+    sink->volchg  = pa_hook_connect(
+                        hooks + PA_CORE_HOOK_SINK_VOLUME_CHANGED,
+                        PA_HOOK_LATE, sink_volume_changed, u
+                    );
     /* source */
     source->put     = pa_hook_connect(
                           hooks + PA_CORE_HOOK_SOURCE_PUT,
@@ -181,6 +194,14 @@ pa_tracker *pa_tracker_init(struct userdata *u)
                        hooks + PA_CORE_HOOK_SINK_INPUT_UNLINK,
                        PA_HOOK_LATE, sink_input_unlink, u
                    );
+    sinp->mutechg = pa_hook_connect(
+                       hooks + PA_CORE_HOOK_SINK_INPUT_MUTE_CHANGED,
+                       PA_HOOK_LATE, sink_input_changed, u
+                   );
+    sinp->moved  = pa_hook_connect(
+                       hooks + PA_CORE_HOOK_SINK_INPUT_MOVE_FINISH,
+                       PA_HOOK_LATE, sink_input_moved, u
+                   );
 
     /* source-output */
     sout->neew   = pa_hook_connect(
@@ -195,6 +216,10 @@ pa_tracker *pa_tracker_init(struct userdata *u)
                        hooks + PA_CORE_HOOK_SOURCE_OUTPUT_UNLINK,
                        PA_HOOK_LATE, source_output_unlink, u
                    );
+    sout->moved  = pa_hook_connect(
+                       hooks + PA_CORE_HOOK_SOURCE_OUTPUT_MOVE_FINISH,
+                       PA_HOOK_LATE, source_output_moved, u
+                   );
 
     return tracker;
 }
@@ -207,6 +232,7 @@ void pa_tracker_done(struct userdata *u)
     pa_sink_hooks       *sink;
     pa_source_hooks     *source;
     pa_sink_input_hooks *sinp;
+    pa_source_output_hooks *sout;
 
     if (u && (tracker = u->tracker)) {
 
@@ -222,6 +248,7 @@ void pa_tracker_done(struct userdata *u)
         pa_hook_slot_free(sink->put);
         pa_hook_slot_free(sink->unlink);
         pa_hook_slot_free(sink->portchg);
+        pa_hook_slot_free(sink->volchg);
 
         source = &tracker->source;
         pa_hook_slot_free(source->put);
@@ -232,6 +259,14 @@ void pa_tracker_done(struct userdata *u)
         pa_hook_slot_free(sinp->neew);
         pa_hook_slot_free(sinp->put);
         pa_hook_slot_free(sinp->unlink);
+        pa_hook_slot_free(sinp->mutechg);
+        pa_hook_slot_free(sinp->moved);
+
+        sout = &tracker->source_output;
+        pa_hook_slot_free(sout->neew);
+        pa_hook_slot_free(sout->put);
+        pa_hook_slot_free(sout->unlink);
+        pa_hook_slot_free(sout->moved);
 
         pa_xfree(tracker);
 
@@ -272,6 +307,7 @@ void pa_tracker_synchronize(struct userdata *u)
 
     PA_IDXSET_FOREACH(sinp, core->sink_inputs, index) {
         pa_discover_register_sink_input(u, sinp);
+        pa_fader_update_stream(u, sinp);
     }
 
     PA_IDXSET_FOREACH(sout, core->source_outputs, index) {
@@ -279,6 +315,7 @@ void pa_tracker_synchronize(struct userdata *u)
     }
 
     mir_router_make_routing(u);
+    mir_router_flush_routing(u);
 }
 
 
@@ -397,6 +434,21 @@ static pa_hook_result_t sink_port_changed(void *hook_data,
     return PA_HOOK_OK;
 }
 
+static pa_hook_result_t sink_volume_changed(void *hook_data,
+                                            void *call_data,
+                                            void *slot_data)
+{
+    pa_sink *sink = (pa_sink *)call_data;
+    struct userdata *u = (struct userdata *)slot_data;
+
+    pa_assert(u);
+    pa_assert(sink);
+
+    pa_fader_sink_volume_changed(u, sink);
+
+    return PA_HOOK_OK;
+}
+
 
 
 static pa_hook_result_t source_put(void *hook_data,
@@ -473,6 +525,7 @@ static pa_hook_result_t sink_input_put(void *hook_data,
     pa_assert(sinp);
 
     pa_discover_add_sink_input(u, sinp);
+    pa_fader_update_stream(u, sinp);
 
     return PA_HOOK_OK;
 }
@@ -488,12 +541,48 @@ static pa_hook_result_t sink_input_unlink(void *hook_data,
     pa_assert(u);
     pa_assert(sinp);
 
+    pa_fader_remove_stream(u, sinp);
     pa_discover_remove_sink_input(u, sinp);
 
     return PA_HOOK_OK;
 }
 
 
+static pa_hook_result_t sink_input_changed(void *hook_data,
+                                           void *call_data,
+                                           void *slot_data)
+{
+    struct pa_sink_input *sinp = (pa_sink_input *)call_data;
+    struct userdata *u = (struct userdata *)slot_data;
+
+    pa_assert(u);
+    pa_assert(sinp);
+
+    pa_fader_update_stream(u, sinp);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t sink_input_moved(void *hook_data,
+                                         void *call_data,
+                                         void *slot_data)
+{
+    struct pa_sink_input *sinp = (pa_sink_input *)call_data;
+    struct userdata *u = (struct userdata *)slot_data;
+    mir_node *node;
+
+    pa_assert(u);
+    pa_assert(sinp);
+
+    pa_fader_update_stream(u, sinp);
+
+    if ((node = pa_discover_find_node_by_sink_input(u, sinp)) && sinp->sink)
+        mir_router_stream_moved(u, node, sinp->sink->index);
+
+    return PA_HOOK_OK;
+}
+
+
 static pa_hook_result_t source_output_new(void *hook_data,
                                           void *call_data,
                                           void *slot_data)
@@ -541,6 +630,24 @@ static pa_hook_result_t source_output_unlink(void *hook_data,
     return PA_HOOK_OK;
 }
 
+static pa_hook_result_t source_output_moved(void *hook_data,
+                                            void *call_data,
+                                            void *slot_data)
+{
+    struct pa_source_output *sout = (pa_source_output *)call_data;
+    struct userdata *u = (struct userdata *)slot_data;
+    mir_node *node;
+
+    pa_assert(u);
+    pa_assert(sout);
+
+    if ((node = pa_discover_find_node_by_source_output(u, sout)) &&
+        sout->source)
+        mir_router_stream_moved(u, node, sout->source->index);
+
+    return PA_HOOK_OK;
+}
+
 
 /*
  * Local Variables:
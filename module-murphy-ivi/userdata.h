@@ -97,6 +97,7 @@ typedef struct pa_source_hooks          pa_source_hooks;
 typedef struct pa_sink_input_hooks      pa_sink_input_hooks;
 typedef struct pa_source_output_hooks   pa_source_output_hooks;
 typedef struct pa_extapi                pa_extapi;
+typedef struct pa_trace                 pa_trace;
 typedef struct pa_murphyif              pa_murphyif;
 typedef struct pa_resource               pa_resource;
 typedef struct pa_resource_rset_data     pa_resource_rset_data;
@@ -249,6 +250,7 @@ struct userdata {
     pa_mir_config *config;
     pa_mir_state   state;
     pa_extapi     *extapi;
+    pa_trace      *trace;
     pa_native_protocol *protocol;
     pa_murphyif   *murphyif;
     pa_resource   *resource;
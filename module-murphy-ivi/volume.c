@@ -34,12 +34,15 @@
 #include "fader.h"
 #include "node.h"
 #include "resource.h"
+#include "trace.h"
 #include "utils.h"
 
-#define VLIM_CLASS_ALLOC_BUCKET  16
+#define VLIM_MEMO_SIZE           64     /* must be power of 2 */
 
 typedef struct vlim_entry  vlim_entry;
 typedef struct vlim_table  vlim_table;
+typedef struct vlim_memo   vlim_memo;
+typedef struct vlim_result vlim_result;
 
 
 struct vlim_entry {
@@ -52,21 +55,42 @@ struct vlim_table {
     vlim_entry  *entries;
 };
 
+struct vlim_result {
+    uint32_t     stamp;          /**< stamp of the evaluation; 0 if unused */
+    uint32_t     node;           /**< index of the device node */
+    int          class;
+    uint32_t     mask;
+    double       attenuation;
+};
+
+struct vlim_memo {
+    uint32_t     stamp;          /**< stamp the counters belong to */
+    uint32_t     hits;           /**< limits found in the memo */
+    uint32_t     misses;         /**< limits evaluated */
+    vlim_result  results[VLIM_MEMO_SIZE];
+};
+
 struct pa_mir_volume {
     int          classlen;       /**< class table length  */
     vlim_table  *classlim;       /**< class indexed table */
     vlim_table   genlim;         /**< generic limit */
     double       maxlim[mir_application_class_end];  /**< per class max. limit */
+    vlim_memo    memo;           /**< limits evaluated with the last stamp */
 };
 
 
 static void add_to_table(vlim_table *, mir_volume_func_t, void *);
 static void destroy_table(vlim_table *);
 static double apply_table(double, vlim_table *, struct userdata *, int,
-                          mir_node *, uint32_t, const char *);
+                          mir_node *, uint32_t, uint32_t, mir_trace_event);
+
+static void memo_reset(vlim_memo *, uint32_t);
+static vlim_result *memo_lookup(vlim_memo *, uint32_t, int, uint32_t,
+                                uint32_t, bool *);
 
 static void reset_volume_limit(struct userdata *, mir_node *, uint32_t);
 static void add_volume_limit(struct userdata *, mir_node *, int);
+static void remove_volume_limit(struct userdata *, mir_node *, int);
 
 
 pa_mir_volume *pa_mir_volume_init(struct userdata *u)
@@ -180,6 +204,8 @@ void mir_volume_make_limiting(struct userdata *u)
 
     stamp = pa_utils_new_stamp();
 
+    /* the context changed; any of the limits might have changed */
+    pa_fader_mark_all_dirty(u);
     pa_fader_apply_volume_limits(u, stamp);
 }
 
@@ -200,6 +226,59 @@ void mir_volume_add_limiting_class(struct userdata *u,
     }
 }
 
+void mir_volume_remove_limiting_class(struct userdata *u,
+                                      mir_node        *node,
+                                      int              class,
+                                      uint32_t         stamp)
+{
+    pa_assert(u);
+    pa_assert(node);
+    pa_assert(class >= 0);
+
+    if (node->implement == mir_device && node->direction == mir_output) {
+        /* the classes of the earlier passes are gone anyway */
+        if (stamp == node->vlim.stamp)
+            remove_volume_limit(u, node, class);
+    }
+}
+
+void mir_volume_expire_limiting_classes(struct userdata *u, uint32_t stamp)
+{
+    mir_node *node;
+    mir_vlim *vlim;
+    uint32_t  idx;
+    uint32_t  gone;
+
+    pa_assert(u);
+
+    /*
+     * every routed stream added its class in this pass. The classes that
+     * did not come back, on devices with or without streams left, have
+     * to lift their attenuation as well
+     */
+    idx = PA_IDXSET_INVALID;
+
+    while ((node = pa_nodeset_iterate_nodes(u, &idx))) {
+        if (node->implement != mir_device || node->direction != mir_output)
+            continue;
+
+        vlim = &node->vlim;
+
+        if (vlim->stamp < stamp && vlim->clmask)
+            reset_volume_limit(u, node, stamp);
+
+        if (vlim->stamp == stamp) {
+            if ((gone = vlim->prevmask & ~vlim->clmask)) {
+                pa_log_debug("volume classes 0x%x are gone from node '%s'",
+                             gone, node->amname);
+                pa_fader_mark_device_dirty(u, node);
+            }
+
+            vlim->prevmask = vlim->clmask;
+        }
+    }
+}
+
 
 double mir_volume_apply_limits(struct userdata *u,
                                mir_node *node,
@@ -212,20 +291,34 @@ double mir_volume_apply_limits(struct userdata *u,
     double devlim, classlim;
     vlim_table *tbl;
     double maxlim;
+    vlim_result *result;
+    bool found;
 
     pa_assert(u);
     pa_assert_se((volume = u->volume));
 
+    /*
+     * the limits depend only on the device, the class and the mask
+     * in the same pass; streams of the same class on the same device
+     * share the evaluation
+     */
+    result = memo_lookup(&volume->memo, node ? node->index : PA_IDXSET_INVALID,
+                         class, mask, stamp, &found);
+
+    if (found)
+        return result->attenuation;
+
     if (class < 0 || class >= volume->classlen) {
         if (class < 0 || class >= mir_application_class_end)
             attenuation = maxlim = MIR_VOLUME_MAX_ATTENUATION;
         else {
-            attenuation = apply_table(0.0, &volume->genlim,
-                                      u,class,node,mask, "device");
+            attenuation = apply_table(0.0, &volume->genlim, u,class,node,
+                                      mask, stamp, mir_trace_volume_device);
         }
     }
     else {
-        devlim = apply_table(0.0, &volume->genlim, u,class,node,mask, "device");
+        devlim = apply_table(0.0, &volume->genlim, u,class,node,mask,
+                             stamp, mir_trace_volume_device);
         classlim = 0.0;
 
         if (class && node) {
@@ -235,7 +328,8 @@ double mir_volume_apply_limits(struct userdata *u,
             maxlim = volume->maxlim[class];
 
             if (class < volume->classlen && (tbl = volume->classlim + class))
-                classlim = apply_table(classlim, tbl, u,class,node,mask, "class");
+                classlim = apply_table(classlim, tbl, u,class,node,mask,
+                                       stamp, mir_trace_volume_class);
 
             if (classlim <= MIR_VOLUME_MAX_ATTENUATION)
                 classlim = MIR_VOLUME_MAX_ATTENUATION;
@@ -246,9 +340,25 @@ double mir_volume_apply_limits(struct userdata *u,
         attenuation = devlim + classlim;
     }
 
+    result->attenuation = attenuation;
+
     return attenuation;
 }
 
+void mir_volume_forget_limits(struct userdata *u)
+{
+    pa_mir_volume *volume;
+
+    pa_assert(u);
+    pa_assert_se((volume = u->volume));
+
+    /*
+     * the fader runs again with the same stamp after a resource or
+     * context change; the scripted limits must be evaluated again
+     */
+    memo_reset(&volume->memo, 0);
+}
+
 uint32_t mir_volume_get_class_mask(int class)
 {
     if (class >= mir_application_class_begin &&
@@ -277,12 +387,12 @@ double mir_volume_suppress(struct userdata *u, int class,
     clmask = mir_volume_get_class_mask(class);
 
     if (suppress && (trigmask = suppress->trigger.clmask)) {
-        pa_log_debug("        volume_supress(class=%d, clmask=0x%x, "
-                     "trigmask=0x%x nodemask=0x%x streammask=0x%x)",
-                     class, clmask, trigmask, node->vlim.clmask, mask);
-
-        if (!(trigmask & clmask) && (trigmask & mask /* node->vlim.clmask */))
+        if (!(trigmask & clmask) && (trigmask & mask /* node->vlim.clmask */)) {
+            mir_trace(u, mir_trace_volume, mir_trace_volume_suppress,
+                      pa_utils_get_stamp(), node->index, class,
+                      MIR_TRACE_DB(*suppress->attenuation), trigmask);
             return *suppress->attenuation;
+        }
     }
 
     return 0.0;
@@ -306,6 +416,67 @@ double mir_volume_correction(struct userdata *u, int class,
     return 0.0;
 }
 
+static void memo_reset(vlim_memo *memo, uint32_t stamp)
+{
+    if (memo->hits || memo->misses) {
+        pa_log_debug("volume limits of stamp %u: %u evaluated, "
+                     "%u reused", memo->stamp, memo->misses, memo->hits);
+    }
+
+    memset(memo, 0, sizeof(*memo));
+    memo->stamp = stamp;
+}
+
+static vlim_result *memo_lookup(vlim_memo *memo,
+                                uint32_t   node,
+                                int        class,
+                                uint32_t   mask,
+                                uint32_t   stamp,
+                                bool      *found)
+{
+    vlim_result *result;
+    uint32_t hash;
+    int i;
+
+    if (stamp != memo->stamp) {
+        /* an older stamp might come back; don't trust its leftovers */
+        memo_reset(memo, stamp);
+    }
+
+    hash = ((node * 31) + (uint32_t)class) * 31 + mask;
+
+    for (i = 0;  i < VLIM_MEMO_SIZE;  i++) {
+        result = memo->results + ((hash + i) & (VLIM_MEMO_SIZE - 1));
+
+        if (result->stamp != stamp)
+            break;
+
+        if (result->node  == node  &&
+            result->class == class &&
+            result->mask  == mask     )
+        {
+            memo->hits++;
+            *found = true;
+            return result;
+        }
+    }
+
+    /* full of this stamp's results: reuse the home slot */
+    if (i >= VLIM_MEMO_SIZE)
+        result = memo->results + (hash & (VLIM_MEMO_SIZE - 1));
+
+    memo->misses++;
+
+    result->stamp = stamp;
+    result->node  = node;
+    result->class = class;
+    result->mask  = mask;
+    result->attenuation = 0.0;
+
+    *found = false;
+    return result;
+}
+
 static void add_to_table(vlim_table *tbl, mir_volume_func_t func, void *arg)
 {
     size_t      size;
@@ -339,7 +510,8 @@ static double apply_table(double attenuation,
                           int class,
                           mir_node *node,
                           uint32_t mask,
-                          const char *type)
+                          uint32_t stamp,
+                          mir_trace_event event)
 {
     static mir_node fake_node;
 
@@ -349,7 +521,6 @@ static double apply_table(double attenuation,
 
     pa_assert(tbl);
     pa_assert(u);
-    pa_assert(type);
 
     if (!node)
         node = &fake_node;
@@ -358,7 +529,8 @@ static double apply_table(double attenuation,
         e = tbl->entries + i;
         a = e->func(u, class, node,mask, e->arg);
 
-        pa_log_debug("        %s limit = %.2lf", type, a);
+        mir_trace(u, mir_trace_volume, event, stamp,
+                  node->index, class, MIR_TRACE_DB(a), mask);
 
         if (a < attenuation)
             attenuation = a;
@@ -373,43 +545,31 @@ static void reset_volume_limit(struct userdata *u,
                                mir_node        *node,
                                uint32_t         stamp)
 {
-    mir_vlim      *vlim = &node->vlim;
-    pa_core       *core;
-    pa_sink       *sink;
-    pa_sink_input *sinp;
-    int            class;
-    uint32_t       i;
+    mir_vlim *vlim = &node->vlim;
 
     pa_assert(u);
     pa_assert(node);
-    pa_assert_se((core = u->core));
 
     pa_log_debug("reset volume classes on node '%s'", node->amname);
 
-    vlim->nclass = 0;
-    vlim->clmask = 0;
-    vlim->stamp  = stamp;
-
-    if ((sink = pa_idxset_get_by_index(core->sinks, node->paidx))) {
-        PA_IDXSET_FOREACH(sinp, sink->inputs, i) {
-            class = pa_utils_get_stream_class(sinp->proplist);
-            add_volume_limit(u, node, class);
-        }
-    }
+    /*
+     * the streams routed to the node add their classes again in this
+     * pass; the classes of all streams on the sink are kept by the fader
+     */
+    memset(vlim->refcnt, 0, sizeof(vlim->refcnt));
+    vlim->prevmask = vlim->clmask;
+    vlim->clmask   = 0;
+    vlim->stamp    = stamp;
 }
 
 
 static void add_volume_limit(struct userdata *u, mir_node *node, int class)
 {
     mir_vlim      *vlim = &node->vlim;
-    pa_mir_volume *volume;
-    int           *classes;
-    size_t         classes_size;
     uint32_t       mask;
 
     pa_assert(u);
     pa_assert(node);
-    pa_assert_se((volume = u->volume));
     pa_assert(class >= 0);
 
     if (class <  mir_application_class_begin ||
@@ -421,31 +581,43 @@ static void add_volume_limit(struct userdata *u, mir_node *node, int class)
     else {
         mask = mir_volume_get_class_mask(class);
 
-        if (class < volume->classlen && volume->classlim[class].nentry > 0) {
-            if (!(vlim->clmask & mask)) {
-
-                if (vlim->nclass < vlim->maxentry)
-                    classes = vlim->classes;
-                else {
-                    vlim->maxentry += VLIM_CLASS_ALLOC_BUCKET;
-                    classes_size    = sizeof(int *) * vlim->maxentry;
-                    vlim->classes   = realloc(vlim->classes, classes_size);
-
-                    pa_assert_se((classes = vlim->classes));
-                }
-
-                vlim->classes[vlim->nclass++] = class;
-            }
-        }
-
-        if (!(vlim->clmask & mask)) {
+        if (!vlim->refcnt[class]++) {
             pa_log_debug("add volume class %d (%s) to node '%s' (clmask 0x%x)",
                          class, mir_node_type_str(class), node->amname,
                          vlim->clmask);
+
+            vlim->clmask |= mask;
+
+            /* the sinks of the device need their limits revisited */
+            if (!(vlim->prevmask & mask))
+                pa_fader_mark_device_dirty(u, node);
         }
+    }
+}
+
+static void remove_volume_limit(struct userdata *u, mir_node *node, int class)
+{
+    mir_vlim *vlim = &node->vlim;
+    uint32_t  mask;
 
-        vlim->clmask |= mask;
+    pa_assert(u);
+    pa_assert(node);
 
+    if (class >= mir_application_class_begin &&
+        class <  mir_application_class_end   &&
+        vlim->refcnt[class] > 0                 )
+    {
+        if (!--vlim->refcnt[class]) {
+            pa_log_debug("remove volume class %d (%s) from node '%s'",
+                         class, mir_node_type_str(class), node->amname);
+
+            mask = ~mir_volume_get_class_mask(class);
+
+            vlim->clmask   &= mask;
+            vlim->prevmask &= mask;
+
+            pa_fader_mark_device_dirty(u, node);
+        }
     }
 }
 
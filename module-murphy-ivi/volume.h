@@ -31,10 +31,9 @@ typedef double (*mir_volume_func_t)(struct userdata *, int, mir_node *,uint32_t,
 typedef void (*mir_change_value_t)(struct userdata *, const char *);
 
 struct mir_vlim {
-    size_t         maxentry;    /**< length of the class table  */
-    size_t         nclass;      /**< number of classes (0 - maxentry) */
-    int           *classes;     /**< class table  */
-    uint32_t       clmask;      /**< bits of the classes */
+    uint16_t       refcnt[mir_application_class_end]; /**< streams per class */
+    uint32_t       clmask;      /**< bits of the classes with streams */
+    uint32_t       prevmask;    /**< clmask of the previous pass */
     uint32_t       stamp;
 };
 
@@ -58,7 +57,11 @@ void mir_volume_add_maximum_limit(struct userdata *, double, size_t, int *);
 void mir_volume_make_limiting(struct userdata *);
 
 void mir_volume_add_limiting_class(struct userdata *,mir_node *,int,uint32_t);
+void mir_volume_remove_limiting_class(struct userdata *, mir_node *, int,
+                                      uint32_t);
+void mir_volume_expire_limiting_classes(struct userdata *, uint32_t);
 double mir_volume_apply_limits(struct userdata *, mir_node *,uint32_t, int,uint32_t);
+void mir_volume_forget_limits(struct userdata *);
 
 uint32_t mir_volume_get_class_mask(int);
 